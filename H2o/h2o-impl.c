@@ -30,7 +30,8 @@
 #include <linux/types.h> /* size_t */
 #include <linux/proc_fs.h>
 #include <linux/fcntl.h> /* O_ACCMODE */
-#include <linux/uaccess.h> /* copy_from/to_user */
+#include <linux/uio.h> /* iov_iter */
+#include <linux/jiffies.h>
 
 #pragma endregion
 
@@ -41,6 +42,10 @@
 int majorH2O = 60;
 /// Buffer to store data.
 #define MAX_SIZE 8
+/// Maximum time in milliseconds an oxygen particle waits for hydrogen (0 waits forever).
+static int readTimeout = 0;
+module_param(readTimeout, int, 0644);
+MODULE_PARM_DESC(readTimeout, "max ms a read waits for hydrogen (0: forever)");
 #pragma endregion
 
 #pragma region Local variables.
@@ -48,6 +53,10 @@ static char *bufferH2O;
 static int in, out, size, k;
 static KMutex mutex;
 static KCondition waitingHydrogen, waitingMolecule;
+/// Number of molecules created, awaited by the writers without the mutex.
+static KEventCount molecules;
+/// Debugfs directory with the statistics of the mutex (make KMUTEX_STATS=y).
+static KStatsDir statsDir;
 #pragma endregion
 #pragma region Declaration of h2o.c functions
 
@@ -77,36 +86,31 @@ static int releaseH2O(struct inode *inode, struct file *pFile);
 /**
  * Reads a fragment of the file.
  *
- * If there are bytes remaining to be read from ``pFilePos``, then the function returns
- * ``count`` and ``pFilePos`` is moved to the first unread byte.
+ * If there are bytes remaining to be read from the position of ``pIocb``, then the
+ * function returns ``count`` and the position is moved to the first unread byte.
+ * A ``readv`` spreads the molecule over all of its segments under a single lock.
  *
- * @param pFile     the file descriptor.
- * @param buf       the direction where the read data should be placed.
- * @param count     the maximum number of bytes to read.
- * @param pFilePos  the position from where the bytes should be read.
+ * @param pIocb  the file descriptor and the position from where the bytes should be read.
+ * @param to     the segments where the read data should be placed.
  *
  * @returns the number of bytes read, 0 if it reaches the file's end or an error code if
  *          the read operation fails.
  */
-static ssize_t readH2O(struct file *pFile, char *buf, size_t ucount, loff_t *pFilePos);
+static ssize_t readH2O(struct kiocb *pIocb, struct iov_iter *to);
 
 /**
  * Adds a hydrogen particle to the file.
  * If the number of bytes to be written is larger than the maximum buffer size, then only
  * the bytes that doesn't exceed the buffer size are written to the file and an error
  * code is returned.
+ * A ``writev`` adds the bytes of all of its segments under a single lock.
  *
- * @param pFile
- *     the file descriptor.
- * @param buf
- *     the data to be written in the file.
- * @param count
- *     the maximum number of bytes to write.
- * @param pFilePos
- *     the position from where the bytes should be written.
+ * @param pIocb
+ *     the file descriptor and the position from where the bytes should be written.
+ * @param from
+ *     the segments with the data to be written in the file.
  */
-static ssize_t writeH2O(struct file *pFile, const char *buf, size_t ucount,
-                        loff_t *pFilePos);
+static ssize_t writeH2O(struct kiocb *pIocb, struct iov_iter *from);
 
 /// Unregisters the H2O driver and releases it's buffer.
 void exitH2O(void);
@@ -126,13 +130,13 @@ static ssize_t end(ssize_t code);
 
 static ssize_t waitHydrogen(void);
 
-static ssize_t createMolecule(char *buf);
+static ssize_t createMolecule(struct iov_iter *to);
 
 static ssize_t waitRelease(void);
 
-static ssize_t writeBytes(const char *buf);
+static ssize_t writeBytes(struct iov_iter *from);
 
-static ssize_t produceHydrogen(ssize_t count, const char *buf);
+static ssize_t produceHydrogen(ssize_t count, struct iov_iter *from);
 
 #pragma endregion
 #pragma endregion
@@ -144,8 +148,8 @@ module_exit(exitH2O);
 
 /// Structure that declares the usual file access functions.
 struct file_operations fileOperations = {
-    .read =  readH2O,
-    .write =  writeH2O,
+    .read_iter =  readH2O,
+    .write_iter =  writeH2O,
     .open =  openH2O,
     .release =  releaseH2O
 };
@@ -165,6 +169,9 @@ int initH2O(void) {
   m_init(&mutex);
   c_init(&waitingHydrogen);
   c_init(&waitingMolecule);
+  ec_init(&molecules);
+  m_stats_init(&statsDir, "h2o");
+  m_stats_register(&statsDir, "mutex", &mutex);
 
   // Allocating bufferH2O
   bufferH2O = kmalloc(MAX_SIZE, GFP_KERNEL);
@@ -181,6 +188,7 @@ int initH2O(void) {
 void exitH2O(void) {
   // Freeing the major number
   unregister_chrdev(majorH2O, "h2o");
+  m_stats_exit(&statsDir);
 
   // Freeing buffer h2o
   if (bufferH2O) {
@@ -205,8 +213,9 @@ static int releaseH2O(struct inode *inode, struct file *pFile) {
 
 #pragma region Read/Write
 
-static ssize_t readH2O(struct file *pFile, char *buf, size_t ucount, loff_t *pFilePos) {
-  ssize_t count = ucount;
+static ssize_t readH2O(struct kiocb *pIocb, struct iov_iter *to) {
+  struct file *pFile = pIocb->ki_filp;
+  ssize_t count = iov_iter_count(to);
   ssize_t response;
 
   printk("INFO:readH2O: Read %p %ld\n", pFile, count);
@@ -214,44 +223,55 @@ static ssize_t readH2O(struct file *pFile, char *buf, size_t ucount, loff_t *pFi
   if ((response = waitHydrogen()) != 0) {
     return endRead(response);
   }
-  if ((response = createMolecule(buf)) != 0) {
+  if ((response = createMolecule(to)) != 0) {
     return endRead(response);
   }
   return endRead(count);
 }
 
-static ssize_t writeH2O(struct file *pFile, const char *buf,
-                        size_t ucount, loff_t *pFilePos) {
-  ssize_t count = ucount;
+static ssize_t writeH2O(struct kiocb *pIocb, struct iov_iter *from) {
+  struct file *pFile = pIocb->ki_filp;
+  ssize_t count = iov_iter_count(from);
   ssize_t response;
+  unsigned long key;
 
   printk("INFO:writeH2O: Write %p %ld\n", pFile, count);
   m_lock(&mutex);
+  // Writers can't be interrupted with <Control+C>, but they can still be killed.
   while (size == MAX_SIZE) {
-    c_wait(&waitingMolecule, &mutex);
+    if (c_wait_killable(&waitingMolecule, &mutex)) {
+      return endWrite(-EINTR);
+    }
   }
-  if ((response = produceHydrogen(count, buf) != 0)) {
+  if ((response = produceHydrogen(count, from) != 0)) {
     return endWrite(response);
   }
-  c_wait(&waitingMolecule, &mutex);
-  return endWrite(count);
+  // The next molecule is awaited without the mutex: createMolecule wakes each writer
+  // once, and none of them has to take the mutex again just to return.
+  key = ec_read(&molecules);
+  endWrite(0);
+  if (ec_await_killable(&molecules, key)) {
+    return -EINTR;
+  }
+  return count;
 }
 
-static ssize_t produceHydrogen(ssize_t count, const char *buf) {
+static ssize_t produceHydrogen(ssize_t count, struct iov_iter *from) {
   ssize_t response;
   for (k = 0; k < count; k++) {
     if ((response = waitRelease()) != 0) {
       return endWrite(response);
     }
-    if ((response = writeBytes(buf)) != 0) {
+    if ((response = writeBytes(from)) != 0) {
       return endWrite(response);
     }
   }
   return 0;
 }
 
-static ssize_t writeBytes(const char *buf) {
-  if (copy_from_user(bufferH2O + in, buf + k, 1) != 0) {
+static ssize_t writeBytes(struct iov_iter *from) {
+  // The iterator advances by itself, across segment boundaries.
+  if (copy_from_iter(bufferH2O + in, 1, from) != 1) {
     return -EFAULT;
   }
   printk("INFO:writeH2O:writeBytes: byte %c (%d) at %d\n", bufferH2O[in], bufferH2O[in],
@@ -274,9 +294,10 @@ static ssize_t waitRelease(void) {
 
 #pragma endregion
 
-static ssize_t createMolecule(char *buf) {
+static ssize_t createMolecule(struct iov_iter *to) {
   for (k = 0; k < MAX_SIZE; k++) {
-    if (copy_to_user(buf + k, bufferH2O + out, 1) != 0) {
+    // A read shorter than a molecule only receives its first bytes.
+    if (iov_iter_count(to) > 0 && copy_to_iter(bufferH2O + out, 1, to) != 1) {
       printk("ERROR:readH2O:createMolecule: Invalid adress");
       return -EFAULT;
     }
@@ -285,13 +306,23 @@ static ssize_t createMolecule(char *buf) {
     out = (out + 1) % MAX_SIZE;
     size--;
   }
+  ec_advance(&molecules);
   c_broadcast(&waitingMolecule);
   return 0;
 }
 
 static ssize_t waitHydrogen(void) {
+  int timeout = readTimeout;
+  unsigned long deadline = jiffies + msecs_to_jiffies(timeout);
+  int response;
   while (size < MAX_SIZE) {
-    if (c_wait(&waitingHydrogen, &mutex)) {
+    response = timeout > 0 ? c_timedwait(&waitingHydrogen, &mutex, deadline)
+                           : c_wait(&waitingHydrogen, &mutex);
+    if (response == -ETIMEDOUT) {
+      printk("INFO:readH2O:waitHydrogen: Timed out.\n");
+      return response;
+    }
+    if (response) {
       printk("INFO:readH2O:waitHydrogen: Interrupted.\n");
       return -EINTR;
     }
@@ -9,9 +9,27 @@
 #include <linux/types.h> /* size_t */
 #include <linux/proc_fs.h>
 #include <linux/uaccess.h> /* copy_from/to_user */
+#include <linux/sched.h> /* current, need_resched() */
+#include <linux/sched/rt.h> /* rt_prio() */
+#include <uapi/linux/sched/types.h> /* struct sched_attr */
+#include <linux/mutex.h>
+#include <linux/jiffies.h>
+#include <linux/timer.h> /* timer_setup_on_stack, mod_timer */
+#include <linux/atomic.h> /* xchg, cmpxchg, smp_load_acquire,
+                            smp_cond_load_relaxed */
+#include <linux/preempt.h>
+#include <linux/lockdep.h>
+#include <linux/compiler.h> /* data_race */
+#include <linux/kcsan-checks.h> /* kcsan_atomic_next */
 
 #include "kmutex.h"
 
+#ifdef KMUTEX_STATS
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#endif
+
 /* Para depurar el monitor cambie quite el comentario de la siguiente linea */
 /* #define DEBUG 1 */
 
@@ -21,36 +39,145 @@
 #define LOG(x) do { ; } while(0)
 #endif
 
+/* Numero maximo de iteraciones de espera activa en m_lock mientras el
+ * dueno del mutex esta en ejecucion en otra CPU.  Con 0 m_lock se bloquea
+ * de inmediato en mutex_sem, como en la version original. */
+#ifndef KMUTEX_SPIN
+#ifdef CONFIG_SMP
+#define KMUTEX_SPIN 1000
+#else
+#define KMUTEX_SPIN 0
+#endif
+#endif
+
+/* Modos de espera en una condicion */
+#define WAIT_INTERRUPTIBLE 0
+#define WAIT_KILLABLE 1
+#define WAIT_TIMEOUT 2
+#define WAIT_UNINTERRUPTIBLE 3
+
+static int await(KCondition *cond, KMutex *mutex, unsigned tag, int mode,
+                 unsigned long deadline);
+static void wake(KCondition *cond, unsigned tag, int all);
+static int block(Link *link, int mode, unsigned long deadline);
+static int down_deadline(struct semaphore *sem, unsigned long deadline);
+static void expire(struct timer_list *timer);
+static int cancel(spinlock_t *lock, LinkQueue *queue, Link *link);
+static void wake_all(LinkQueue *queue);
+static int ec_wait(KEventCount *ec, unsigned long key, int mode);
+static int rw_await(KCondition *cond, KRWLock *rw, int mode,
+                    unsigned long deadline);
 static void queue_init(LinkQueue *queue);
-static int empty(LinkQueue *queue);
 static void append(LinkQueue *queue, Link *link);
+static void insert(LinkQueue *queue, Link *link);
 static Link *extract(LinkQueue *queue);
-static int remove(LinkQueue *queue, Link *link);
+static void take_all(LinkQueue *queue, LinkQueue *taken);
+static void remove(LinkQueue *queue, Link *link);
+static int acquire(KMutex *mutex);
+static void release(KMutex *mutex);
+static int lock_prio(KMutex *mutex);
+static void unlock_prio(KMutex *mutex);
+static void boost(KMutex *mutex, Link *link);
+static void unboost(KMutex *mutex);
+static int lock_barge(KMutex *mutex);
+static void unlock_barge(KMutex *mutex);
+static int trylock_barge(KMutex *mutex);
+static void relock_barge(KMutex *mutex, Link *link);
+static int spin(KMutex *mutex, struct semaphore *sem);
+static int attempt(KMutex *mutex, struct semaphore *sem);
+static int running(struct task_struct *task);
+
+#ifdef KMUTEX_STATS
+static u64 stats_now(void);
+static void stats_acquired(KMutex *mutex, int contended, u64 since);
+static void stats_handoff(KMutex *mutex, Link *link);
+static void stats_released(KMutex *mutex);
+static void stats_cwait(KMutex *mutex);
+static void stats_woken(Link *link);
+#else
+static inline u64 stats_now(void) { return 0; }
+static inline void stats_acquired(KMutex *mutex, int contended, u64 since) { }
+static inline void stats_handoff(KMutex *mutex, Link *link) { }
+static inline void stats_released(KMutex *mutex) { }
+static inline void stats_cwait(KMutex *mutex) { }
+static inline void stats_woken(Link *link) { }
+#endif
 #ifdef DEBUG
 static void show_queue(char *msg, LinkQueue *queue);
 #endif
 
-void m_init(KMutex *mutex) {
+/* m_init es una macro (ver kmutex.h) que entrega a lockdep una clase
+ * distinta para cada lugar en que se inicializa un mutex */
+void __m_init(KMutex *mutex, unsigned flags, const char *name,
+              struct lock_class_key *key) {
+#ifdef KMUTEX_MCS
+  mutex->tail= NULL;
+  mutex->onode.next= NULL;
+#else
   sema_init(&mutex->mutex_sem, 1);
+#endif
+  mutex->owner= NULL;
+  spin_lock_init(&mutex->lock);
   queue_init(&mutex->queue);
+  if (flags & KMUTEX_BOUNDED)
+    flags|= KMUTEX_BARGE;
+  mutex->flags= flags;
+  mutex->handoff= 0;
+  mutex->max_wait= msecs_to_jiffies(KMUTEX_MAX_WAIT_MS);
+  mutex_init(&mutex->pi_lock);
+  mutex->boosted= NULL;
+#ifdef KMUTEX_STATS
+  memset(&mutex->stats, 0, sizeof(mutex->stats));
+#endif
+#ifdef CONFIG_DEBUG_LOCK_ALLOC
+  lockdep_init_map(&mutex->dep_map, name, key, 0);
+#endif
 }
 
 void c_init(KCondition *cond) {
+  cond->mutex= NULL;
   queue_init(&cond->wait_queue);
+  cond->skipped= 0;
 }
 
 void m_lock(KMutex *mutex) {
+  u64 start= stats_now();
+  int contended;
+  might_sleep();
   LOG(printk("m_lock (%p): requesting\n", mutex););
-  down(&mutex->mutex_sem);
+  /* lockdep revisa el orden de los candados antes de bloquearse */
+  mutex_acquire(&mutex->dep_map, 0, 0, _RET_IP_);
+  if (mutex->flags & KMUTEX_PRIO)
+    contended= lock_prio(mutex);
+  else if (mutex->flags & KMUTEX_BARGE)
+    contended= lock_barge(mutex);
+  else
+    contended= acquire(mutex);
+  WRITE_ONCE(mutex->owner, current);
+  stats_acquired(mutex, contended, start);
   LOG(printk("m_lock (%p): acquired\n", mutex););
 }
 
 void m_unlock(KMutex *mutex) {
-  Link *link= extract(&mutex->queue);
+  Link *link;
+  mutex_release(&mutex->dep_map, _RET_IP_);
+  stats_released(mutex);
+  if (mutex->flags & KMUTEX_PRIO) {
+    unlock_prio(mutex);
+    return;
+  }
+  if (mutex->flags & KMUTEX_BARGE) {
+    unlock_barge(mutex);
+    return;
+  }
+  spin_lock(&mutex->lock);
+  link= extract(&mutex->queue);
+  spin_unlock(&mutex->lock);
   if (link==NULL) {
-    /* Ningun otro proceso esperaba este mutex.  Se libera depositando
-     * un ticket en mutex->mutex_sem. */
-    up(&mutex->mutex_sem);
+    /* Ningun proceso despertado por c_signal/c_broadcast esperaba este
+     * mutex.  Se libera depositando un ticket en mutex->mutex_sem o se
+     * cede al siguiente en la cola MCS (ver release). */
+    release(mutex);
     LOG(printk("m_unlock (%p): unlocked\n", mutex););
   }
   else {
@@ -63,107 +190,941 @@ void m_unlock(KMutex *mutex) {
      * no ser el mismo que lo pidio.  Esto no es correcto para los struct
      * mutex.
      * Al declarar mutex_sem como struct_semaphore, cualquier proceso
-     * puede depositar un ticket en el. */
+     * puede depositar un ticket en el.
+     * El nuevo dueno se registra antes de despertarlo para que los
+     * procesos que esperan activamente en m_lock no se queden mirando
+     * a un dueno que ya no lo es.
+     * Con KMUTEX_MCS el proceso hereda del mismo modo el lugar del dueno
+     * en la cola MCS, mutex->onode. */
+    WRITE_ONCE(mutex->owner, link->task);
     up(&link->wait_sem); /* Despierta al proceso en espera */
     LOG(printk("m_unlock (%p): giving to link %p\n", mutex, link););
   }
 }
 
 int c_wait(KCondition *cond, KMutex *mutex) {
+  return await(cond, mutex, C_ANY, WAIT_INTERRUPTIBLE, 0);
+}
+
+int c_wait_killable(KCondition *cond, KMutex *mutex) {
+  return await(cond, mutex, C_ANY, WAIT_KILLABLE, 0);
+}
+
+int c_timedwait(KCondition *cond, KMutex *mutex, unsigned long deadline) {
+  if (time_after_eq(jiffies, deadline))
+    return -ETIMEDOUT; /* el plazo ya se cumplio: ni siquiera se espera */
+  return await(cond, mutex, C_ANY, WAIT_TIMEOUT, deadline);
+}
+
+int c_wait_tag(KCondition *cond, KMutex *mutex, unsigned tag) {
+  return await(cond, mutex, tag, WAIT_INTERRUPTIBLE, 0);
+}
+
+int c_timedwait_tag(KCondition *cond, KMutex *mutex, unsigned tag,
+                    unsigned long deadline) {
+  if (time_after_eq(jiffies, deadline))
+    return -ETIMEDOUT;
+  return await(cond, mutex, tag, WAIT_TIMEOUT, deadline);
+}
+
+static int await(KCondition *cond, KMutex *mutex, unsigned tag, int mode,
+                 unsigned long deadline) {
   int rc= 0;
   Link link;
   link.mutex= mutex;
+  link.task= current;
+  link.tag= tag;
+  link.prio= current->prio;
   sema_init(&link.wait_sem, 0);
+  stats_cwait(mutex);
+  spin_lock(&mutex->lock);
+  WRITE_ONCE(cond->mutex, mutex); /* wake lo lee sin mutex->lock */
   append(&cond->wait_queue, &link);
   LOG(printk("c_wait (%p,%p): waiting on link %p\n", cond, mutex, &link);
       show_queue("c_wait queue status", &cond->wait_queue);
   );
+  spin_unlock(&mutex->lock);
   m_unlock(mutex); /* libera el mutex */
 
-  rc= down_interruptible(&link.wait_sem);
+  rc= block(&link, mode, deadline);
   if (rc) {
-    /* Si down_interruptible retorno por un control-C, y no por
-     * c_broadcast o c_signal, hay que borrar este link de
-     * cond->wait_queue.
+    /* Si la espera termino por un control-C o porque se cumplio el plazo,
+     * y no por c_broadcast o c_signal, hay que borrar este link de
+     * cond->wait_queue.  Si en cambio el link ya fue movido a mutex->queue,
+     * el proceso ya fue despertado y el mutex le sera cedido por m_unlock:
+     * hay que esperar ese traspaso, porque si se llamara a m_lock, el
+     * mutex se cederia a un link que nadie espera.  Ver cancel.
      */
-    LOG(printk("c_wait (%p, %p): link %p interrupted\n", cond, mutex, &link););
-    m_lock(mutex);
-    if (remove(&cond->wait_queue, &link)<0)
-      printk("<1>c_wait: cannot find link\n");
+    LOG(printk("c_wait (%p, %p): link %p interrupted (%d)\n", cond, mutex,
+               &link, rc););
+    if (cancel(&mutex->lock, &cond->wait_queue, &link)) {
+      spin_unlock(&mutex->lock);
+      m_lock(mutex);
+      return rc;
+    }
+    rc= 0;
   }
-  /* Si down_interruptible retorno porque se invoco c_broadcast o c_signal,
+  /* Si la espera termino porque se invoco c_broadcast o c_signal,
    * no hay que volver a solicitar el mutex: m_unlock cede directamente el
-   * mutex a este proceso.
+   * mutex a este proceso.  Con KMUTEX_BARGE, en cambio, m_unlock solo lo
+   * desperto y debe competir por el mutex.  Para lockdep, este proceso lo
+   * adquiere ahora.
    */
-  return rc; /* -EINTR si el proceso recibio una senal */
+  if (mutex->flags & KMUTEX_BARGE)
+    relock_barge(mutex, &link);
+  mutex_acquire(&mutex->dep_map, 0, 0, _RET_IP_);
+  stats_handoff(mutex, &link);
+  return rc; /* -EINTR si el proceso recibio una senal, -ETIMEDOUT si se
+              * cumplio el plazo */
 }
 
 void c_broadcast(KCondition *cond) {
-  /* Los procesos en espera ganaran la propiedad del mutex respetando
-   * el orden de llegada.  Ademas tienen prioridad por sobre los procesos
-   * que habian pedido previamente el mutex con m_lock. */
-  while (!empty(&cond->wait_queue)) {
-    Link *link= extract(&cond->wait_queue);
-    append(&link->mutex->queue, link);
+  wake(cond, C_ANY, 1);
+}
+
+void c_signal(KCondition *cond) {
+  wake(cond, C_ANY, 0);
+}
+
+void c_broadcast_tag(KCondition *cond, unsigned tag) {
+  wake(cond, tag, 1);
+}
+
+void c_signal_tag(KCondition *cond, unsigned tag) {
+  wake(cond, tag, 0);
+}
+
+/* Mueve desde cond->wait_queue hacia link->mutex->queue el primer link
+ * (all==0) o todos los links (all!=0) cuya etiqueta comparte algun bit con
+ * tag.  Los procesos en espera ganaran la propiedad del mutex respetando
+ * el orden de llegada.  Ademas tienen prioridad por sobre los procesos
+ * que habian pedido previamente el mutex con m_lock.  Con KMUTEX_PRIO, en
+ * cambio, se ubican en la cola segun su prioridad, junto a los procesos
+ * que esperan en m_lock. */
+static void wake(KCondition *cond, unsigned tag, int all) {
+  Link *link, *next;
+  KMutex *mutex= READ_ONCE(cond->mutex);
+  if (mutex==NULL)
+    return; /* nadie ha esperado nunca en esta condicion */
+  spin_lock(&mutex->lock);
+  for (link= cond->wait_queue.head; link!=NULL; link= next) {
+    next= link->next;
+    if ((link->tag & tag)==0) {
+      cond->skipped++;
+      continue;
+    }
+    remove(&cond->wait_queue, link);
+    link->since= jiffies;
+    if (mutex->flags & KMUTEX_PRIO)
+      insert(&mutex->queue, link);
+    else
+      append(&mutex->queue, link);
+    stats_woken(link);
     LOG(printk("c_broadcast (%p): inserting link %p in mutex %p\n", cond,
                link, link->mutex););
+    if (!all)
+      break;
   }
+  spin_unlock(&mutex->lock);
 }
 
-void c_signal(KCondition *cond) {
-  Link *link= extract(&cond->wait_queue);
-  if (link!=NULL) {
-    /* Se mueve este link desde cond->wait_queue hacia link->mutex->queue */
-    append(&link->mutex->queue, link);
-    LOG(printk("c_signal (%p): inserting link %p in mutex %p\n", cond,
-               link, link->mutex););
+/* Espera en link->wait_sem el ticket que deposita quien saque el link de
+ * su cola, segun el modo de espera.  Retorna 0 si recibio el ticket,
+ * -EINTR si recibio una senal y -ETIMEDOUT si se cumplio el plazo. */
+static int block(Link *link, int mode, unsigned long deadline) {
+  int rc= 0;
+  switch (mode) {
+  case WAIT_KILLABLE:
+    rc= down_killable(&link->wait_sem);
+    break;
+  case WAIT_TIMEOUT:
+    rc= down_deadline(&link->wait_sem, deadline);
+    break;
+  case WAIT_UNINTERRUPTIBLE:
+    down(&link->wait_sem);
+    break;
+  default:
+    rc= down_interruptible(&link->wait_sem);
   }
-  else {
-    LOG(printk("c_signal (%p): queue empty\n", cond););
+  return rc;
+}
+
+/* down_timeout duerme en TASK_UNINTERRUPTIBLE: un proceso no se podria
+ * interrumpir durante un plazo largo, que ademas dispararia el aviso de
+ * tareas colgadas.  Se espera en cambio con down_interruptible, y al
+ * cumplirse el plazo expire deposita un ticket en sem.  Retorna 0 si
+ * recibio el ticket de quien saco el link de su cola, -EINTR si recibio
+ * una senal y -ETIMEDOUT si se cumplio el plazo.  Si expire alcanzo a
+ * depositar su ticket, hay uno de mas: o es el que se obtuvo, o se
+ * consume aqui, o lo consume cancel en vez del ticket que no llegara. */
+struct deadline {
+  struct timer_list timer;
+  struct semaphore *sem;
+};
+
+static int down_deadline(struct semaphore *sem, unsigned long deadline) {
+  struct deadline d;
+  int rc;
+  d.sem= sem;
+  timer_setup_on_stack(&d.timer, expire, 0);
+  mod_timer(&d.timer, deadline);
+  rc= down_interruptible(sem);
+  if (!timer_delete_sync(&d.timer)) {
+    /* el plazo se cumplio: expire deposito un ticket */
+    if (rc)
+      down(sem); /* la senal llego primero: se consume el de expire */
+    else
+      rc= -ETIMEDOUT; /* cancel sabra si el ticket era de expire */
   }
+  destroy_timer_on_stack(&d.timer);
+  return rc;
 }
 
-/*** Manejo de colas **************************************/
+static void expire(struct timer_list *timer) {
+  struct deadline *d= container_of(timer, struct deadline, timer);
+  up(d->sem);
+}
 
-static void queue_init(LinkQueue *queue) {
-  queue->head= NULL;
-  queue->last_next= &queue->head;
+/* La espera de link en queue fue interrumpida.  Si link sigue en queue, lo
+ * saca y retorna 1 con lock tomado, para que el invocador deshaga lo que
+ * haya que deshacer antes de liberarlo.  Como la cola es doblemente
+ * enlazada, sacarlo es O(1).  Si otro proceso ya saco el link, ese proceso
+ * le depositara un ticket que no se puede perder: lo espera y retorna 0,
+ * es decir la espera termino normalmente. */
+static int cancel(spinlock_t *lock, LinkQueue *queue, Link *link) {
+  spin_lock(lock);
+  /* wake_all puede estar sacando el link de otra cola sin lock */
+  if (READ_ONCE(link->queue)==queue) {
+    remove(queue, link);
+    return 1;
+  }
+  spin_unlock(lock);
+  down(&link->wait_sem);
+  return 0;
+}
+
+/* Deposita un ticket a cada link de queue, una cola obtenida con take_all
+ * que ya no es accesible por otros procesos.  El link se saca de la cola
+ * antes de depositar el ticket, porque desde ese momento su proceso puede
+ * retornar y el link deja de existir. */
+static void wake_all(LinkQueue *queue) {
+  Link *link;
+  while ((link= extract(queue))!=NULL)
+    up(&link->wait_sem);
+}
+
+/*** Semaforos, barreras y contadores de eventos *******/
+
+void s_init(KSemaphore *sem, int count) {
+  spin_lock_init(&sem->lock);
+  sem->count= count;
+  queue_init(&sem->queue);
+}
+
+int s_wait(KSemaphore *sem) {
+  Link link;
+  spin_lock(&sem->lock);
+  if (sem->count>0) {
+    sem->count--;
+    spin_unlock(&sem->lock);
+    return 0;
+  }
+  link.task= current;
+  sema_init(&link.wait_sem, 0);
+  append(&sem->queue, &link);
+  spin_unlock(&sem->lock);
+  if (block(&link, WAIT_INTERRUPTIBLE, 0) &&
+      cancel(&sem->lock, &sem->queue, &link)) {
+    spin_unlock(&sem->lock);
+    return -EINTR;
+  }
+  return 0;
+}
+
+/* El ticket se entrega directamente al primer proceso en espera, sin pasar
+ * por sem->count, de modo que nadie se lo puede robar. */
+void s_post(KSemaphore *sem) {
+  Link *link;
+  spin_lock(&sem->lock);
+  link= extract(&sem->queue);
+  if (link==NULL)
+    sem->count++;
+  spin_unlock(&sem->lock);
+  if (link!=NULL)
+    up(&link->wait_sem);
+}
+
+void b_init(KBarrier *barrier, int parties) {
+  spin_lock_init(&barrier->lock);
+  barrier->parties= parties;
+  barrier->arrived= 0;
+  barrier->generation= 0;
+  queue_init(&barrier->queue);
+}
+
+/* El ultimo en llegar abre la barrera: cambia de generacion y se lleva
+ * la cola completa, para despertar a cada proceso una sola vez y fuera del
+ * spinlock.  Los que lleguen despues ya esperan en la nueva generacion. */
+int b_wait(KBarrier *barrier) {
+  Link link;
+  LinkQueue opened;
+  spin_lock(&barrier->lock);
+  if (++barrier->arrived==barrier->parties) {
+    barrier->arrived= 0;
+    barrier->generation++;
+    take_all(&barrier->queue, &opened);
+    spin_unlock(&barrier->lock);
+    wake_all(&opened);
+    return 1;
+  }
+  link.task= current;
+  sema_init(&link.wait_sem, 0);
+  append(&barrier->queue, &link);
+  spin_unlock(&barrier->lock);
+  if (block(&link, WAIT_INTERRUPTIBLE, 0) &&
+      cancel(&barrier->lock, &barrier->queue, &link)) {
+    barrier->arrived--;
+    spin_unlock(&barrier->lock);
+    return -EINTR;
+  }
+  return 0;
+}
+
+void ec_init(KEventCount *ec) {
+  spin_lock_init(&ec->lock);
+  ec->count= 0;
+  queue_init(&ec->queue);
+}
+
+unsigned long ec_read(KEventCount *ec) {
+  return smp_load_acquire(&ec->count);
+}
+
+int ec_await(KEventCount *ec, unsigned long key) {
+  return ec_wait(ec, key, WAIT_INTERRUPTIBLE);
+}
+
+int ec_await_killable(KEventCount *ec, unsigned long key) {
+  return ec_wait(ec, key, WAIT_KILLABLE);
+}
+
+static int ec_wait(KEventCount *ec, unsigned long key, int mode) {
+  Link link;
+  spin_lock(&ec->lock);
+  if (ec->count!=key) {
+    spin_unlock(&ec->lock);
+    return 0; /* ya hubo un ec_advance despues de ec_read */
+  }
+  link.task= current;
+  sema_init(&link.wait_sem, 0);
+  append(&ec->queue, &link);
+  spin_unlock(&ec->lock);
+  if (block(&link, mode, 0) && cancel(&ec->lock, &ec->queue, &link)) {
+    spin_unlock(&ec->lock);
+    return -EINTR;
+  }
+  return 0;
+}
+
+/* La escritura de count es un release: quien vea el nuevo valor en
+ * ec_read ve tambien todo lo que se modifico antes de ec_advance. */
+void ec_advance(KEventCount *ec) {
+  LinkQueue woken;
+  spin_lock(&ec->lock);
+  smp_store_release(&ec->count, ec->count+1);
+  take_all(&ec->queue, &woken);
+  spin_unlock(&ec->lock);
+  wake_all(&woken);
+}
+
+/*** Lectores/escritores *********************************/
+
+void rw_init(KRWLock *rw) {
+  m_init(&rw->mutex);
+  c_init(&rw->cond);
+  rw->readers= 0;
+  rw->writing= 0;
+  rw->pend_writers= 0;
+}
+
+void rw_rlock(KRWLock *rw) {
+  m_lock(&rw->mutex);
+  /* Para evitar la hambruna de los escritores, un lector no ingresa si
+   * hay escritores esperando, aunque ninguno tenga el candado todavia. */
+  while (rw->writing || rw->pend_writers>0)
+    await(&rw->cond, &rw->mutex, C_ANY, WAIT_UNINTERRUPTIBLE, 0);
+  rw->readers++;
+  m_unlock(&rw->mutex);
+}
+
+void rw_runlock(KRWLock *rw) {
+  m_lock(&rw->mutex);
+  rw->readers--;
+  if (rw->readers==0 && rw->pend_writers>0)
+    c_broadcast(&rw->cond);
+  m_unlock(&rw->mutex);
+}
+
+void rw_wlock(KRWLock *rw) {
+  m_lock(&rw->mutex);
+  rw->pend_writers++;
+  while (rw->writing || rw->readers>0)
+    await(&rw->cond, &rw->mutex, C_ANY, WAIT_UNINTERRUPTIBLE, 0);
+  rw->pend_writers--;
+  rw->writing= 1;
+  m_unlock(&rw->mutex);
+}
+
+void rw_wunlock(KRWLock *rw) {
+  m_lock(&rw->mutex);
+  rw->writing= 0;
+  c_broadcast(&rw->cond);
+  m_unlock(&rw->mutex);
+}
+
+int rw_rwait(KCondition *cond, KRWLock *rw) {
+  return rw_await(cond, rw, WAIT_INTERRUPTIBLE, 0);
+}
+
+int rw_rtimedwait(KCondition *cond, KRWLock *rw, unsigned long deadline) {
+  if (time_after_eq(jiffies, deadline))
+    return -ETIMEDOUT;
+  return rw_await(cond, rw, WAIT_TIMEOUT, deadline);
+}
+
+/* Las condiciones de un KRWLock se usan con rw->mutex.  El lector deja de
+ * ser lector y se encola en cond sin soltar rw->mutex, por lo que un
+ * escritor, que necesita que readers llegue a 0 para modificar los datos y
+ * luego rw->mutex para invocar rw_broadcast, no puede despertar a nadie
+ * entre que el lector decidio esperar y que quedo en la cola. */
+static int rw_await(KCondition *cond, KRWLock *rw, int mode,
+                    unsigned long deadline) {
+  int rc;
+  m_lock(&rw->mutex);
+  rw->readers--;
+  if (rw->readers==0 && rw->pend_writers>0)
+    c_broadcast(&rw->cond);
+  rc= await(cond, &rw->mutex, C_ANY, mode, deadline);
+  while (rw->writing || rw->pend_writers>0)
+    await(&rw->cond, &rw->mutex, C_ANY, WAIT_UNINTERRUPTIBLE, 0);
+  rw->readers++;
+  m_unlock(&rw->mutex);
+  return rc;
+}
+
+void rw_broadcast(KCondition *cond, KRWLock *rw) {
+  m_lock(&rw->mutex);
+  c_broadcast(cond);
+  m_unlock(&rw->mutex);
+}
+
+/*** Candados de secuencia ******************************/
+
+/* Maximo de accesos de un lector entre sq_read_begin y sq_read_retry que
+ * KCSAN no debe reportar como carreras (como KCSAN_SEQLOCK_REGION_MAX) */
+#define SQ_KCSAN_MAX 1000
+
+void sq_init(KSeqLock *sq) {
+  m_init(&sq->mutex);
+  sq->seq= 0;
+}
+
+void sq_write_lock(KSeqLock *sq) {
+  m_lock(&sq->mutex);
 }
 
-static int empty(LinkQueue *queue) {
-  return queue->head==NULL;
+/* Como en write_seqcount_begin: la secuencia impar debe ser visible antes
+ * que cualquier modificacion de los datos */
+void sq_write_begin(KSeqLock *sq) {
+  WRITE_ONCE(sq->seq, sq->seq+1);
+  smp_wmb();
+}
+
+void sq_write_end(KSeqLock *sq) {
+  smp_wmb();
+  WRITE_ONCE(sq->seq, sq->seq+1);
+}
+
+void sq_write_unlock(KSeqLock *sq) {
+  m_unlock(&sq->mutex);
+}
+
+unsigned sq_read_begin(KSeqLock *sq) {
+  unsigned seq;
+  while ((seq= READ_ONCE(sq->seq)) & 1)
+    cpu_relax(); /* el escritor no duerme hasta sq_write_end */
+  smp_rmb();
+  /* las lecturas de los datos pueden toparse con un escritor: si es asi,
+   * sq_read_retry lo detecta */
+  kcsan_atomic_next(SQ_KCSAN_MAX);
+  return seq;
+}
+
+int sq_read_retry(KSeqLock *sq, unsigned seq) {
+  kcsan_atomic_next(0);
+  smp_rmb();
+  return READ_ONCE(sq->seq)!=seq;
+}
+
+/*** Adquisicion y liberacion ***************************/
+
+/* acquire obtiene el mutex para m_lock y retorna 1 si tuvo que esperar.
+ * release lo devuelve o se lo cede al siguiente proceso que lo espera en
+ * m_lock.  Los procesos despertados por c_signal/c_broadcast no pasan por
+ * aqui: m_unlock se los cede antes de invocar release.
+ */
+
+#ifndef KMUTEX_MCS
+
+static int acquire(KMutex *mutex) {
+  if (down_trylock(&mutex->mutex_sem)==0)
+    return 0;
+  if (!spin(mutex, &mutex->mutex_sem))
+    down(&mutex->mutex_sem);
+  return 1;
+}
+
+static void release(KMutex *mutex) {
+  WRITE_ONCE(mutex->owner, NULL);
+  up(&mutex->mutex_sem);
+}
+
+#else
+
+/* Cola MCS: mutex->tail apunta al ultimo link de la cola de procesos que
+ * esperan en m_lock y el next de cada link apunta al que llego despues.
+ * Cada link esta en la pila de su proceso, que espera un ticket en el
+ * semaforo de su propio link: el proceso que devuelve el mutex se lo
+ * deposita solo al sucesor, sin tocar una linea de cache compartida por
+ * todos los que esperan.
+ * Como el link de acquire desaparece al retornar de m_lock, el nuevo dueno
+ * traspasa su lugar en la cola a mutex->onode, que pertenece al mutex y
+ * que release usa para encontrar al sucesor.  Invariante: mutex->onode.next
+ * es NULL cuando onode no esta en la cola.
+ */
+static int acquire(KMutex *mutex) {
+  Link node, *prev, *next;
+  if (cmpxchg(&mutex->tail, NULL, &mutex->onode)==NULL)
+    return 0; /* estaba libre */
+  node.task= current;
+  node.next= NULL;
+  sema_init(&node.wait_sem, 0);
+  /* El dueno o el proceso anterior esperan a que prev->next apunte a node:
+   * este proceso no debe ser desplazado de la CPU entre las dos
+   * instrucciones. */
+  preempt_disable();
+  prev= xchg(&mutex->tail, &node);
+  if (prev!=NULL)
+    WRITE_ONCE(prev->next, &node);
+  preempt_enable();
+  if (prev!=NULL && !spin(mutex, &node.wait_sem))
+    down(&node.wait_sem);
+  /* Ahora este proceso es el dueno: traspasa el lugar de node a onode */
+  if (cmpxchg(&mutex->tail, &node, &mutex->onode)!=&node) {
+    /* un sucesor se esta encolando */
+    next= smp_cond_load_relaxed(&node.next, VAL!=NULL);
+    mutex->onode.next= next;
+  }
+  return 1;
+}
+
+static void release(KMutex *mutex) {
+  Link *next;
+  WRITE_ONCE(mutex->owner, NULL);
+  if (cmpxchg(&mutex->tail, &mutex->onode, NULL)==&mutex->onode)
+    return; /* nadie esperaba */
+  /* el sucesor se esta encolando */
+  next= smp_cond_load_relaxed(&mutex->onode.next, VAL!=NULL);
+  mutex->onode.next= NULL;
+  WRITE_ONCE(mutex->owner, next->task);
+  up(&next->wait_sem);
+}
+
+#endif
+
+/*** Modo prioridad **************************************/
+
+/* Con KMUTEX_PRIO no se usa mutex_sem ni la cola MCS: el mutex esta libre
+ * si owner es NULL, y tanto los procesos que esperan en m_lock como los
+ * despertados por c_signal/c_broadcast esperan en mutex->queue, ordenada
+ * por prioridad.  m_unlock cede el mutex a la cabeza de la cola bajo
+ * mutex->lock, por lo que owner es NULL solo si la cola esta vacia. */
+static int lock_prio(KMutex *mutex) {
+  Link link;
+  spin_lock(&mutex->lock);
+  if (mutex->owner==NULL) {
+    WRITE_ONCE(mutex->owner, current);
+    spin_unlock(&mutex->lock);
+    return 0;
+  }
+  link.task= current;
+  link.prio= current->prio;
+  sema_init(&link.wait_sem, 0);
+  insert(&mutex->queue, &link);
+  spin_unlock(&mutex->lock);
+  if (rt_prio(link.prio))
+    boost(mutex, &link);
+  down(&link.wait_sem); /* m_unlock registra a este proceso como dueno */
+  return 1;
+}
+
+static void unlock_prio(KMutex *mutex) {
+  Link *link;
+  spin_lock(&mutex->lock);
+  link= extract(&mutex->queue);
+  WRITE_ONCE(mutex->owner, link!=NULL ? link->task : NULL);
+  spin_unlock(&mutex->lock);
+  if (link!=NULL)
+    up(&link->wait_sem);
+  /* Se despierta al sucesor antes de devolver la prioridad heredada, para
+   * que ningun proceso de prioridad intermedia se interponga.  Como este
+   * proceso ya no es el dueno, boost no le puede volver a heredar una
+   * prioridad despues de que la devuelva. */
+  mutex_lock(&mutex->pi_lock);
+  if (mutex->boosted==current)
+    unboost(mutex);
+  mutex_unlock(&mutex->pi_lock);
+}
+
+/* El proceso de tiempo real de link espera en mutex->queue: si el dueno del
+ * mutex tiene menor prioridad, hereda la de link->task.  Se registra la
+ * prioridad original del dueno para que unlock_prio la restaure.
+ * pi_lock serializa boost con unlock_prio, y sched_setattr_nocheck, que
+ * puede bloquearse, se invoca fuera de mutex->lock.  Los procesos
+ * SCHED_DEADLINE no heredan prioridades. */
+static void boost(KMutex *mutex, Link *link) {
+  struct task_struct *owner;
+  struct sched_attr attr= {
+    .size= sizeof(attr),
+    .sched_policy= SCHED_FIFO,
+    .sched_priority= MAX_RT_PRIO-1-link->prio,
+  };
+  mutex_lock(&mutex->pi_lock);
+  spin_lock(&mutex->lock);
+  owner= mutex->owner;
+  if (link->queue!=&mutex->queue || owner==NULL || owner->prio<=link->prio ||
+      owner->policy==SCHED_DEADLINE)
+    owner= NULL; /* ya obtuvo el mutex o el dueno no necesita heredar */
+  spin_unlock(&mutex->lock);
+  if (owner!=NULL) {
+    if (mutex->boosted!=owner) {
+      /* El dueno anterior todavia no alcanza a devolver la prioridad que
+       * heredo: se la devuelve aqui, porque solo se registra una */
+      if (mutex->boosted!=NULL)
+        unboost(mutex);
+      mutex->boosted= owner;
+      mutex->saved_policy= owner->policy;
+      mutex->saved_rt_priority= owner->rt_priority;
+      mutex->saved_nice= task_nice(owner);
+    }
+    sched_setattr_nocheck(owner, &attr);
+  }
+  mutex_unlock(&mutex->pi_lock);
+}
+
+/* Restaura la prioridad original de mutex->boosted.  Requiere pi_lock. */
+static void unboost(KMutex *mutex) {
+  struct sched_attr attr= {
+    .size= sizeof(attr),
+    .sched_policy= mutex->saved_policy,
+    .sched_priority= mutex->saved_rt_priority,
+    .sched_nice= mutex->saved_nice,
+  };
+  sched_setattr_nocheck(mutex->boosted, &attr);
+  mutex->boosted= NULL;
+}
+
+/*** Barging ********************************************/
+
+/* Con KMUTEX_BARGE tampoco se usa mutex_sem: el mutex esta libre si owner
+ * es NULL, y se toma bajo mutex->lock.  m_unlock libera el mutex y
+ * despierta al primero de mutex->queue, que debe competir por el mutex con
+ * los procesos que esten en ejecucion.  Un proceso que esta en ejecucion
+ * obtiene el mutex sin cambios de contexto, por lo que no se forman
+ * convoyes, pero un proceso en espera puede perder muchas veces seguidas.
+ * Con KMUTEX_BOUNDED, si un proceso despertado pierde y ya espero mas de
+ * max_wait, pide con mutex->handoff que el siguiente m_unlock le ceda el
+ * mutex directamente. */
+static int lock_barge(KMutex *mutex) {
+  Link link;
+  if (trylock_barge(mutex))
+    return 0;
+  if (spin(mutex, NULL))
+    return 1;
+  link.task= current;
+  link.since= jiffies;
+  sema_init(&link.wait_sem, 0);
+  spin_lock(&mutex->lock);
+  if (mutex->owner==NULL) {
+    WRITE_ONCE(mutex->owner, current);
+    spin_unlock(&mutex->lock);
+    return 1;
+  }
+  append(&mutex->queue, &link);
+  spin_unlock(&mutex->lock);
+  down(&link.wait_sem);
+  relock_barge(mutex, &link);
+  return 1;
+}
+
+static void unlock_barge(KMutex *mutex) {
+  Link *link;
+  spin_lock(&mutex->lock);
+  link= extract(&mutex->queue);
+  if (link!=NULL && mutex->handoff) {
+    mutex->handoff= 0;
+    WRITE_ONCE(mutex->owner, link->task);
+  }
+  else
+    WRITE_ONCE(mutex->owner, NULL);
+  spin_unlock(&mutex->lock);
+  if (link!=NULL)
+    up(&link->wait_sem);
+}
+
+static int trylock_barge(KMutex *mutex) {
+  int locked= 0;
+  if (READ_ONCE(mutex->owner)!=NULL)
+    return 0; /* no vale la pena tomar mutex->lock */
+  spin_lock(&mutex->lock);
+  if (mutex->owner==NULL) {
+    WRITE_ONCE(mutex->owner, current);
+    locked= 1;
+  }
+  spin_unlock(&mutex->lock);
+  return locked;
+}
+
+/* m_unlock saco link de mutex->queue y lo desperto: se compite por el
+ * mutex hasta obtenerlo, volviendo cada vez a la cabeza de la cola. */
+static void relock_barge(KMutex *mutex, Link *link) {
+  spin_lock(&mutex->lock);
+  while (mutex->owner!=current) { /* si no se lo cedieron con handoff */
+    if (mutex->owner==NULL) {
+      WRITE_ONCE(mutex->owner, current);
+      break;
+    }
+    if ((mutex->flags & KMUTEX_BOUNDED) &&
+        time_after(jiffies, link->since+mutex->max_wait))
+      mutex->handoff= 1;
+    link->queue= &mutex->queue;
+    link->prev= NULL;
+    link->next= mutex->queue.head;
+    if (mutex->queue.head!=NULL)
+      mutex->queue.head->prev= link;
+    else
+      mutex->queue.tail= link;
+    mutex->queue.head= link;
+    spin_unlock(&mutex->lock);
+    down(&link->wait_sem);
+    spin_lock(&mutex->lock);
+  }
+  spin_unlock(&mutex->lock);
+}
+
+/*** Espera activa optimista *****************************/
+
+/* Mientras el dueno del mutex este en ejecucion en otra CPU es probable
+ * que lo devuelva pronto, y esperarlo activamente es mucho mas barato que
+ * dormir en el semaforo sem (mutex_sem o, con KMUTEX_MCS, el del link
+ * propio) y pagar dos cambios de contexto.  Se deja de esperar si el dueno
+ * se bloquea, si este proceso debe ceder la CPU o si se agotan las
+ * KMUTEX_SPIN iteraciones.  Retorna 1 si se obtuvo un ticket de sem.
+ * Los links de c_signal/c_broadcast siguen teniendo prioridad: m_unlock
+ * les cede el mutex sin depositar un ticket en mutex_sem, por lo que
+ * nunca se los puede robar un proceso que espera activamente.
+ */
+static int spin(KMutex *mutex, struct semaphore *sem) {
+  int i;
+  for (i= 0; ; i++) {
+    struct task_struct *owner;
+    if (attempt(mutex, sem))
+      return 1;
+    if (i>=KMUTEX_SPIN || need_resched())
+      return 0;
+    /* owner podria terminar mientras se le consulta: el descriptor del
+     * proceso se libera recien despues de un periodo de gracia de RCU */
+    rcu_read_lock();
+    owner= READ_ONCE(mutex->owner);
+    while (owner!=NULL && owner==READ_ONCE(mutex->owner) && i<KMUTEX_SPIN) {
+      if (!running(owner) || need_resched()) {
+        rcu_read_unlock();
+        return attempt(mutex, sem);
+      }
+      cpu_relax();
+      i++;
+    }
+    rcu_read_unlock();
+    cpu_relax();
+  }
+}
+
+/* Retorna 1 si obtuvo un ticket de sem o, si sem es NULL (KMUTEX_BARGE),
+ * el mutex mismo */
+static int attempt(KMutex *mutex, struct semaphore *sem) {
+  return sem!=NULL ? down_trylock(sem)==0 : trylock_barge(mutex);
+}
+
+static int running(struct task_struct *task) {
+#ifdef CONFIG_SMP
+  return READ_ONCE(task->on_cpu) && !vcpu_is_preempted(task_cpu(task));
+#else
+  return 0;
+#endif
+}
+
+/*** Estadisticas ****************************************/
+
+#ifdef KMUTEX_STATS
+
+/* Todas las estadisticas se modifican teniendo el mutex, de modo que no
+ * necesitan sincronizacion adicional.  Las lecturas desde debugfs pueden
+ * ver valores de distintos instantes, lo que es aceptable. */
+
+static u64 stats_now(void) {
+  return ktime_get_ns();
+}
+
+static void stats_acquired(KMutex *mutex, int contended, u64 since) {
+  KMutexStats *st= &mutex->stats;
+  u64 now= ktime_get_ns();
+  st->acquisitions++;
+  if (contended) {
+    u64 wait= now-since;
+    st->contended++;
+    st->wait_total+= wait;
+    if (wait>st->wait_max)
+      st->wait_max= wait;
+  }
+  st->acquired_at= now;
+}
+
+/* Un proceso despertado por c_signal/c_broadcast espera el mutex desde
+ * ese momento, hasta que m_unlock se lo cede */
+static void stats_handoff(KMutex *mutex, Link *link) {
+  stats_acquired(mutex, 1, link->woken_at);
+}
+
+static void stats_released(KMutex *mutex) {
+  KMutexStats *st= &mutex->stats;
+  u64 hold= ktime_get_ns()-st->acquired_at;
+  st->hold_total+= hold;
+  if (hold>st->hold_max)
+    st->hold_max= hold;
+}
+
+static void stats_cwait(KMutex *mutex) {
+  mutex->stats.c_waits++;
+}
+
+static void stats_woken(Link *link) {
+  link->woken_at= ktime_get_ns();
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int stats_show(struct seq_file *s, void *unused) {
+  KMutex *mutex= s->private;
+  /* una copia para no mirar dos veces; el dueno del mutex puede estar
+   * modificandolas, lo que se acepta */
+  KMutexStats st= data_race(mutex->stats);
+  seq_printf(s, "acquisitions: %lu\n", st.acquisitions);
+  seq_printf(s, "contended: %lu\n", st.contended);
+  seq_printf(s, "wait_total_ns: %llu\n", st.wait_total);
+  seq_printf(s, "wait_max_ns: %llu\n", st.wait_max);
+  seq_printf(s, "hold_total_ns: %llu\n", st.hold_total);
+  seq_printf(s, "hold_max_ns: %llu\n", st.hold_max);
+  seq_printf(s, "c_waits: %lu\n", st.c_waits);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+#endif
+
+void m_stats_init(KStatsDir *dir, const char *driver) {
+#ifdef CONFIG_DEBUG_FS
+  dir->root= debugfs_create_dir(driver, NULL);
+  dir->locks= debugfs_create_dir("locks", dir->root);
+#endif
+}
+
+void m_stats_register(KStatsDir *dir, const char *name, KMutex *mutex) {
+#ifdef CONFIG_DEBUG_FS
+  debugfs_create_file(name, 0444, dir->locks, mutex, &stats_fops);
+#endif
+}
+
+void m_stats_exit(KStatsDir *dir) {
+#ifdef CONFIG_DEBUG_FS
+  debugfs_remove_recursive(dir->root);
+  dir->root= dir->locks= NULL;
+#endif
+}
+
+#endif
+
+/*** Manejo de colas **************************************/
+
+static void queue_init(LinkQueue *queue) {
+  queue->head= queue->tail= NULL;
 }
 
 static void append(LinkQueue *queue, Link *link) {
+  link->queue= queue;
   link->next= NULL;
-  *queue->last_next= link;
-  queue->last_next= &link->next;
+  link->prev= queue->tail;
+  if (queue->tail!=NULL)
+    queue->tail->next= link;
+  else
+    queue->head= link;
+  queue->tail= link;
+}
+
+/* Agrega link a queue despues de todos los links de igual o mayor
+ * prioridad (menor valor de prio).  Se recorre desde el final porque lo
+ * usual es que lleguen procesos de la misma prioridad. */
+static void insert(LinkQueue *queue, Link *link) {
+  Link *prev= queue->tail;
+  while (prev!=NULL && prev->prio>link->prio)
+    prev= prev->prev;
+  link->queue= queue;
+  link->prev= prev;
+  link->next= prev!=NULL ? prev->next : queue->head;
+  if (link->next!=NULL)
+    link->next->prev= link;
+  else
+    queue->tail= link;
+  if (prev!=NULL)
+    prev->next= link;
+  else
+    queue->head= link;
 }
 
 static Link *extract(LinkQueue *queue) {
   Link *head= queue->head;
-  if (head!=NULL) {
-    Link *next= head->next;
-    queue->head= next;
-    if (next==NULL)
-      queue->last_next= &queue->head;
-  }
+  if (head!=NULL)
+    remove(queue, head);
   return head;
 }
 
-static int remove(LinkQueue *queue, Link *link) {
-  Link **plink;
-  plink= &queue->head;
-  while (*plink!=NULL && *plink!=link)
-    plink= &((*plink)->next);
-  if (*plink!=link)
-    return -1;
-  else {
-    *plink= link->next;
-    if (link->next==NULL)
-      queue->last_next= plink;
-    return 0;
-  }
+/* Traspasa todos los links de queue a taken.  Como cada link queda
+ * apuntando a taken, cancel ya no los encuentra en queue. */
+static void take_all(LinkQueue *queue, LinkQueue *taken) {
+  Link *link;
+  *taken= *queue;
+  for (link= taken->head; link!=NULL; link= link->next)
+    link->queue= taken;
+  queue_init(queue);
+}
+
+static void remove(LinkQueue *queue, Link *link) {
+  if (link->prev!=NULL)
+    link->prev->next= link->next;
+  else
+    queue->head= link->next;
+  if (link->next!=NULL)
+    link->next->prev= link->prev;
+  else
+    queue->tail= link->prev;
+  WRITE_ONCE(link->queue, NULL); /* ver cancel */
 }
 
 #ifdef DEBUG
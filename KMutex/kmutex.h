@@ -3,45 +3,358 @@
  * para ser usados dentro del nucleo de Linux.
  * La API es la siguiente:
  * void m_init(KMutex *m)     -> inicializa el mutex m
+ * void m_init_flags(KMutex *m, unsigned flags) -> inicializa el mutex m
+ *   con las opciones flags (ver KMUTEX_PRIO mas abajo)
  * void c_init(KCondition *c) -> inicializa la condicion c 
- * void m_lock(KMutex *m)     -> solicita la propiedad del mutex
+ * void m_lock(KMutex *m)     -> solicita la propiedad del mutex.  Si el
+ *   mutex esta ocupado y su dueno esta en ejecucion en otra CPU, espera
+ *   activamente un momento antes de bloquearse (ver KMUTEX_SPIN en kmutex.c)
  * void m_unlock(KMutex *m)   -> devuelve el mutex
  * int c_wait(KCondition *c, KMutex *m) -> devuelve el mutex m y se bloquea
  *   hasta que otro proceso invoque c_broadcast(c) o c_signal(c), en cuyo
  *   caso c_wait retorna 0.  Si el proceso recibe una senal como control-C
  *   mientras espera, c_wait retorna -EINTR.  Antes de retornar, se solicita
  *   nuevamente la propiedad de m.
+ * int c_wait_killable(KCondition *c, KMutex *m) -> como c_wait, pero solo
+ *   se interrumpe con senales fatales (como SIGKILL)
+ * int c_timedwait(KCondition *c, KMutex *m, unsigned long deadline) ->
+ *   como c_wait, pero si el plazo deadline (en jiffies absolutos, ej.
+ *   jiffies+msecs_to_jiffies(100)) se cumple antes de que otro proceso
+ *   invoque c_broadcast(c) o c_signal(c), retorna -ETIMEDOUT.  Como c_wait,
+ *   retorna -EINTR si el proceso recibe una senal.
  * void c_broadcast(KCondition *c)  -> despierta todos los procesos que esperan
  *   en c_wait(c), que deben continuar esperando obtener la propiedad del
  *   mutex
  * void c_signal(KCondition *c) -> despierta un solo proceso que espera en
  *   c_wait(c), que debe continuar esperando obtener la propiedad del mutex
+ * Al igual que con pthread_cond_wait, una condicion debe usarse siempre
+ * con el mismo mutex.
+ *
+ * Cuando procesos que esperan por motivos distintos comparten una misma
+ * condicion (p.ej. lectores que esperan datos y escritores que esperan
+ * espacio), cada uno puede indicar el motivo de su espera con una etiqueta
+ * (un bit), para que c_broadcast_tag despierte solo a los interesados:
+ * int c_wait_tag(KCondition *c, KMutex *m, unsigned tag) -> como c_wait,
+ *   pero el proceso solo es despertado por c_broadcast/c_signal o por
+ *   c_broadcast_tag/c_signal_tag con una etiqueta que incluya algun bit de
+ *   tag.  c_wait(c, m) equivale a c_wait_tag(c, m, C_ANY).
+ * int c_timedwait_tag(KCondition *c, KMutex *m, unsigned tag,
+ *   unsigned long deadline) -> como c_timedwait, pero con una etiqueta
+ *   como en c_wait_tag
+ * void c_broadcast_tag(KCondition *c, unsigned tag) -> despierta todos los
+ *   procesos cuya etiqueta comparte algun bit con tag
+ * void c_signal_tag(KCondition *c, unsigned tag) -> despierta el primero
+ *   de esos procesos
+ * c->skipped cuenta los procesos que un c_broadcast_tag o c_signal_tag
+ * dejo durmiendo, es decir los despertares inutiles que se evitaron.
+ *
+ * Estadisticas: si se compila con -DKMUTEX_STATS (en los drivers:
+ * make KMUTEX_STATS=y), cada KMutex cuenta sus adquisiciones, las que
+ * tuvieron que esperar, el tiempo total y maximo de espera y de posesion
+ * del mutex (en ns) y las invocaciones de c_wait.  Un driver publica sus
+ * mutex en /sys/kernel/debug/<driver>/locks/<nombre> con:
+ * void m_stats_init(KStatsDir *d, const char *driver) -> crea el directorio
+ * void m_stats_register(KStatsDir *d, const char *name, KMutex *m) ->
+ *   publica las estadisticas de m con el nombre name
+ * void m_stats_exit(KStatsDir *d) -> borra el directorio
+ * Sin KMUTEX_STATS estas funciones no hacen nada.
+ *
+ * Depuracion: en un nucleo con CONFIG_PROVE_LOCKING, lockdep conoce cada
+ * KMutex como si fuese un struct mutex, incluyendo su traspaso en c_wait, y
+ * revisa que los candados se pidan siempre en el mismo orden.  Los accesos
+ * sin candado estan marcados para KCSAN.  Ver README.txt.
+ *
+ * Modo prioridad: un mutex inicializado con m_init_flags(m, KMUTEX_PRIO)
+ * se entrega al proceso en espera de mayor prioridad (la de planificacion
+ * del proceso al empezar a esperar), y por orden de llegada entre procesos
+ * de igual prioridad.  Esto incluye a los despertados por c_signal y
+ * c_broadcast.  Ademas, mientras espera un proceso de tiempo real
+ * (SCHED_FIFO o SCHED_RR) de mayor prioridad que el dueno del mutex, el
+ * dueno hereda esa prioridad hasta que invoca m_unlock.  La herencia no es
+ * transitiva: si el dueno espera a su vez otro mutex, el dueno de ese otro
+ * mutex no la hereda.  En este modo m_lock no espera activamente y m_unlock
+ * puede bloquearse un instante.
+ *
+ * Politica de entrega: por omision m_unlock cede el mutex directamente al
+ * primer proceso en espera.  Es equitativo, pero cada traspaso cuesta un
+ * cambio de contexto y, si la seccion critica es corta, el throughput se
+ * desploma (convoy).  Con m_init_flags se puede elegir otra politica:
+ * KMUTEX_BARGE -> m_unlock libera el mutex y despierta al primer proceso
+ *   en espera, pero otro proceso en ejecucion puede tomarlo antes (barging).
+ *   Si eso ocurre, el proceso despertado vuelve a la cabeza de la cola.
+ * KMUTEX_BOUNDED -> como KMUTEX_BARGE, pero si un proceso lleva esperando
+ *   mas de m->max_wait jiffies (por omision KMUTEX_MAX_WAIT_MS ms), el
+ *   siguiente m_unlock se lo cede directamente.  Se puede cambiar
+ *   m->max_wait despues de m_init_flags.
+ * KMUTEX_PRIO siempre entrega directamente el mutex e ignora estas
+ * opciones.
+ *
+ * Cola MCS: si se compila con -DKMUTEX_MCS (en los drivers:
+ * make KMUTEX_MCS=y), m_lock encola a cada proceso en espera en un link en
+ * su propia pila y el proceso espera activamente o duerme en el semaforo
+ * de ese link, en vez de competir por un semaforo comun.  Asi, con muchas
+ * CPUs compitiendo, cada una mira solo su propia linea de cache.  La API no
+ * cambia, pero con mas procesos que CPUs cada traspaso cuesta un cambio de
+ * contexto y el mutex no se reparte mas equitativamente (ver la comparacion
+ * en user/README.txt).
+ *
+ * Ademas se ofrece un candado de lectores/escritores (tipo KRWLock) al
+ * estilo de pthread_rwlock_t.  Da preferencia a los escritores: si hay un
+ * escritor esperando, los nuevos lectores esperan a que este termine, de
+ * modo que un flujo continuo de lectores no puede causar hambruna a los
+ * escritores.
+ * void rw_init(KRWLock *rw)    -> inicializa el candado rw
+ * void rw_rlock(KRWLock *rw)   -> solicita rw en modo compartido (lector)
+ * void rw_runlock(KRWLock *rw) -> devuelve el modo compartido
+ * void rw_wlock(KRWLock *rw)   -> solicita rw en modo exclusivo (escritor)
+ * void rw_wunlock(KRWLock *rw) -> devuelve el modo exclusivo
+ * int rw_rwait(KCondition *c, KRWLock *rw) -> un lector devuelve rw y se
+ *   bloquea como en c_wait(c, ...), hasta que otro proceso invoque
+ *   rw_broadcast(c, rw).  Antes de retornar vuelve a solicitar rw en modo
+ *   compartido.  Retorna -EINTR si recibe una senal.
+ * int rw_rtimedwait(KCondition *c, KRWLock *rw, unsigned long deadline) ->
+ *   como rw_rwait, pero con un plazo como en c_timedwait
+ * void rw_broadcast(KCondition *c, KRWLock *rw) -> despierta a todos los
+ *   lectores que esperan en rw_rwait(c, rw).  Se puede invocar teniendo o
+ *   no la propiedad de rw.
+ *
+ * Para datos que se leen mucho mas de lo que se escriben, y de los que un
+ * lector solo necesita una copia consistente, se ofrece un candado de
+ * secuencia (tipo KSeqLock) al estilo de seqlock_t.  Los escritores se
+ * excluyen con un KMutex, pero los lectores no piden nada: copian los
+ * datos y reintentan si un escritor los modifico mientras tanto.  Asi un
+ * lector nunca bloquea a un escritor ni a otro lector:
+ * void sq_init(KSeqLock *sq) -> inicializa el candado sq
+ * void sq_write_lock(KSeqLock *sq) -> solicita sq para escribir.  Solo
+ *   excluye a los otros escritores, por lo que se puede, por ejemplo,
+ *   invocar copy_from_user teniendo sq.
+ * void sq_write_begin(KSeqLock *sq) -> anuncia a los lectores que los datos
+ *   se estan modificando.  Hasta sq_write_end no se puede dormir, porque
+ *   los lectores esperan activamente.
+ * void sq_write_end(KSeqLock *sq) -> termina la modificacion
+ * void sq_write_unlock(KSeqLock *sq) -> devuelve sq
+ * unsigned sq_read_begin(KSeqLock *sq) -> comienza una lectura y retorna
+ *   la secuencia que se entrega a sq_read_retry
+ * int sq_read_retry(KSeqLock *sq, unsigned seq) -> retorna verdadero si un
+ *   escritor modifico los datos desde sq_read_begin, en cuyo caso lo leido
+ *   no sirve y hay que repetir la lectura.  Por lo mismo, entre
+ *   sq_read_begin y sq_read_retry no se puede dormir, ni usar un puntero
+ *   leido sin revisar que apunta a algo valido, ni copy_to_user: se copia
+ *   a un buffer propio y se transfiere despues.
+ * Ejemplo:
+ *   do {
+ *     seq= sq_read_begin(&sq);
+ *     memcpy(copia, datos, n);
+ *   } while (sq_read_retry(&sq, seq));
+ *
+ * Por ultimo se ofrecen tres primitivas que no necesitan un KMutex.  Cada
+ * una usa un spinlock y una cola de links como los de KCondition, y
+ * despierta a cada proceso una sola vez con el semaforo de su link:
+ * void s_init(KSemaphore *s, int count) -> inicializa el semaforo s con
+ *   count tickets
+ * int s_wait(KSemaphore *s) -> obtiene un ticket, esperando si no hay.
+ *   Retorna -EINTR si recibe una senal antes de obtenerlo.
+ * void s_post(KSemaphore *s) -> deposita un ticket, que se entrega
+ *   directamente al primer proceso en espera
+ * void b_init(KBarrier *b, int n) -> inicializa una barrera para n procesos
+ * int b_wait(KBarrier *b) -> espera a que n procesos hayan invocado b_wait.
+ *   Retorna 1 en el ultimo en llegar, que abre la barrera, 0 en los demas
+ *   y -EINTR si el proceso recibe una senal antes de que se abra.  La
+ *   barrera se puede reusar de inmediato: b->generation cuenta las veces
+ *   que se ha abierto.
+ * void ec_init(KEventCount *ec) -> inicializa el contador de eventos ec
+ * unsigned long ec_read(KEventCount *ec) -> retorna el valor actual de ec,
+ *   que se usa como llave para ec_await
+ * int ec_await(KEventCount *ec, unsigned long key) -> espera hasta que ec
+ *   deje de valer key, es decir hasta que alguien invoque ec_advance
+ *   despues del ec_read que obtuvo key.  Retorna -EINTR si recibe una senal.
+ * int ec_await_killable(KEventCount *ec, unsigned long key) -> como
+ *   ec_await, pero solo se interrumpe con senales fatales
+ * void ec_advance(KEventCount *ec) -> incrementa ec y despierta a todos
+ *   los procesos que esperan en ec_await
+ * Con un contador de eventos un proceso puede esperar que ocurra algo sin
+ *   tener un mutex: lee la llave con ec_read, revisa si lo que espera ya
+ *   ocurrio y, si no, invoca ec_await.  Quien hace que ocurra invoca
+ *   ec_advance despues, y el proceso no puede perder ese aviso.
  */
 
 typedef struct {
   struct Link *head;
-  struct Link **last_next;
+  struct Link *tail;
 } LinkQueue;
 
+#ifdef KMUTEX_STATS
+typedef struct {
+  unsigned long acquisitions;
+  unsigned long contended; /* adquisiciones que tuvieron que esperar */
+  u64 wait_total, wait_max; /* ns esperando el mutex */
+  u64 hold_total, hold_max; /* ns en posesion del mutex */
+  unsigned long c_waits;
+  u64 acquired_at; /* instante en que el dueno actual obtuvo el mutex */
+} KMutexStats;
+#endif
+
+/* Las colas son doblemente enlazadas y cada link sabe en que cola esta,
+ * para que un proceso interrumpido se pueda sacar de ella en O(1). */
 typedef struct Link {
   struct semaphore wait_sem;
   struct kmutex *mutex;
-  struct Link *next;
+  struct task_struct *task;
+  unsigned tag; /* motivo de la espera en una condicion */
+  int prio; /* prioridad de task al empezar a esperar (modo KMUTEX_PRIO) */
+  unsigned long since; /* jiffies al empezar a esperar el mutex */
+  LinkQueue *queue; /* cola en que esta el link, NULL si no esta en ninguna */
+  struct Link *next, *prev; /* con KMUTEX_MCS, next enlaza tambien la
+                             * cola MCS de m_lock */
+#ifdef KMUTEX_STATS
+  u64 woken_at; /* instante en que c_signal/c_broadcast lo desperto */
+#endif
 } Link;
 
 typedef struct kmutex {
+#ifdef KMUTEX_MCS
+  Link *tail; /* ultimo link de la cola MCS, NULL si el mutex esta libre */
+  Link onode; /* representa al dueno en la cola MCS */
+#else
   struct semaphore mutex_sem;
+#endif
+  struct task_struct *owner; /* NULL si el mutex esta libre */
+  spinlock_t lock; /* protege queue y las colas de sus condiciones */
   LinkQueue queue;
+  unsigned flags;
+  int handoff; /* KMUTEX_BOUNDED: el proximo m_unlock cede el mutex */
+  unsigned long max_wait; /* KMUTEX_BOUNDED: espera maxima en jiffies */
+  /* Herencia de prioridad (KMUTEX_PRIO), protegida por pi_lock */
+  struct mutex pi_lock;
+  struct task_struct *boosted; /* dueno con la prioridad heredada */
+  int saved_policy, saved_rt_priority, saved_nice; /* la de boosted */
+#ifdef KMUTEX_STATS
+  KMutexStats stats; /* solo se modifica teniendo el mutex */
+#endif
+#ifdef CONFIG_DEBUG_LOCK_ALLOC
+  struct lockdep_map dep_map;
+#endif
 } KMutex;
 
 typedef struct {
+  struct kmutex *mutex; /* el mutex con que se usa la condicion */
   LinkQueue wait_queue;
+  unsigned long skipped; /* despertares evitados por las etiquetas */
 } KCondition;
 
-void m_init(KMutex *mutex);
+#define C_ANY (~0u) /* etiqueta que calza con cualquier otra */
+
+struct lock_class_key;
+
+#define KMUTEX_PRIO 1 /* ordena la cola por prioridad, con herencia */
+#define KMUTEX_BARGE 2 /* m_unlock no cede el mutex al despertar */
+#define KMUTEX_BOUNDED 4 /* KMUTEX_BARGE, salvo si alguien lleva mucho esperando */
+#ifndef KMUTEX_MAX_WAIT_MS
+#define KMUTEX_MAX_WAIT_MS 1
+#endif
+
+void __m_init(KMutex *mutex, unsigned flags, const char *name,
+              struct lock_class_key *key);
+#ifdef CONFIG_DEBUG_LOCK_ALLOC
+#define m_init_flags(mutex, flags) do { \
+  static struct lock_class_key __key; \
+  __m_init((mutex), (flags), #mutex, &__key); \
+} while (0)
+#else
+#define m_init_flags(mutex, flags) __m_init((mutex), (flags), NULL, NULL)
+#endif
+#define m_init(mutex) m_init_flags(mutex, 0)
 void c_init(KCondition *cond);
 void m_lock(KMutex *mutex);
 void m_unlock(KMutex *mutex);
 int c_wait(KCondition *cond, KMutex *mutex);
+int c_wait_killable(KCondition *cond, KMutex *mutex);
+int c_timedwait(KCondition *cond, KMutex *mutex, unsigned long deadline);
 void c_broadcast(KCondition *cond);
 void c_signal(KCondition *cond);
+int c_wait_tag(KCondition *cond, KMutex *mutex, unsigned tag);
+int c_timedwait_tag(KCondition *cond, KMutex *mutex, unsigned tag,
+                    unsigned long deadline);
+void c_broadcast_tag(KCondition *cond, unsigned tag);
+void c_signal_tag(KCondition *cond, unsigned tag);
+
+struct dentry;
+
+typedef struct {
+  struct dentry *root;  /* /sys/kernel/debug/<driver> */
+  struct dentry *locks; /* /sys/kernel/debug/<driver>/locks */
+} KStatsDir;
+
+#ifdef KMUTEX_STATS
+void m_stats_init(KStatsDir *dir, const char *driver);
+void m_stats_register(KStatsDir *dir, const char *name, KMutex *mutex);
+void m_stats_exit(KStatsDir *dir);
+#else
+static inline void m_stats_init(KStatsDir *dir, const char *driver) { }
+static inline void m_stats_register(KStatsDir *dir, const char *name,
+                                    KMutex *mutex) { }
+static inline void m_stats_exit(KStatsDir *dir) { }
+#endif
+
+typedef struct {
+  KMutex mutex;    /* protege los campos siguientes */
+  KCondition cond; /* para esperar el ingreso */
+  int readers;     /* lectores que tienen el candado */
+  int writing;     /* verdadero si un escritor tiene el candado */
+  int pend_writers; /* escritores esperando el candado */
+} KRWLock;
+
+void rw_init(KRWLock *rw);
+void rw_rlock(KRWLock *rw);
+void rw_runlock(KRWLock *rw);
+void rw_wlock(KRWLock *rw);
+void rw_wunlock(KRWLock *rw);
+int rw_rwait(KCondition *cond, KRWLock *rw);
+int rw_rtimedwait(KCondition *cond, KRWLock *rw, unsigned long deadline);
+void rw_broadcast(KCondition *cond, KRWLock *rw);
+
+typedef struct {
+  KMutex mutex; /* excluye a los escritores */
+  unsigned seq; /* impar mientras un escritor modifica los datos */
+} KSeqLock;
+
+void sq_init(KSeqLock *sq);
+void sq_write_lock(KSeqLock *sq);
+void sq_write_begin(KSeqLock *sq);
+void sq_write_end(KSeqLock *sq);
+void sq_write_unlock(KSeqLock *sq);
+unsigned sq_read_begin(KSeqLock *sq);
+int sq_read_retry(KSeqLock *sq, unsigned seq);
+
+typedef struct {
+  spinlock_t lock; /* protege los campos siguientes */
+  int count;       /* tickets disponibles */
+  LinkQueue queue; /* procesos esperando un ticket */
+} KSemaphore;
+
+void s_init(KSemaphore *sem, int count);
+int s_wait(KSemaphore *sem);
+void s_post(KSemaphore *sem);
+
+typedef struct {
+  spinlock_t lock; /* protege los campos siguientes */
+  int parties;     /* procesos que abren la barrera */
+  int arrived;     /* procesos que esperan en la generacion actual */
+  unsigned long generation; /* veces que se ha abierto la barrera */
+  LinkQueue queue;
+} KBarrier;
+
+void b_init(KBarrier *barrier, int parties);
+int b_wait(KBarrier *barrier);
+
+typedef struct {
+  spinlock_t lock; /* protege queue y las modificaciones de count */
+  unsigned long count;
+  LinkQueue queue; /* procesos en ec_await */
+} KEventCount;
+
+void ec_init(KEventCount *ec);
+unsigned long ec_read(KEventCount *ec);
+int ec_await(KEventCount *ec, unsigned long key);
+int ec_await_killable(KEventCount *ec, unsigned long key);
+void ec_advance(KEventCount *ec);
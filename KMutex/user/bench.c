@@ -0,0 +1,738 @@
+/* kmutex-bench: mide el rendimiento de KMutex y KCondition compilados en
+ * modo usuario (ver kshim.h).  Mide:
+ * - el costo de m_lock/m_unlock sin contencion
+ * - para cada numero de threads: throughput con contencion, latencia del
+ *   traspaso del mutex (desde que un thread llama a m_unlock hasta que otro
+ *   lo obtiene) y equidad entre threads (indice de Jain: 1 es perfecto)
+ * - la latencia de c_signal (ping-pong entre 2 threads) y de c_broadcast
+ * - lo mismo para ec_advance (KEventCount) y el tiempo que demora en
+ *   abrirse un KBarrier
+ * - la espera en m_lock de un proceso de tiempo real que compite con
+ *   procesos normales, con un mutex en orden de llegada y con uno en modo
+ *   prioridad (KMUTEX_PRIO)
+ * - miles de threads en c_wait interrumpidos a la vez por una senal: cuanto
+ *   demoran en salir de c_wait y, con KMUTEX_STATS, cuanto tiempo tiene
+ *   cada uno el mutex
+ *
+ * kmutex-bench-mcs es el mismo programa con KMutex compilado con la cola
+ * MCS (-DKMUTEX_MCS).  make compare corre ambos con 2, 8, 32 y 64 threads.
+ *
+ * Si se compila con make KMUTEX_STATS=y, muestra ademas las estadisticas
+ * que KMutex registra durante las mediciones con contencion.
+ *
+ * Ademas verifica la exclusion mutua: si el contador protegido por el
+ * mutex no cuadra, si la barrera no se abrio tantas veces como debia o si
+ * un proceso se quedo con una prioridad heredada, termina con status 1.
+ *
+ * Uso: ./kmutex-bench [-d ms] [-t n1,n2,...] [-n iteraciones]
+ *                     [-s n1,n2,...]
+ *   -d: duracion de cada medicion con contencion (por omision 1000 ms)
+ *   -t: numeros de threads a medir (por omision 1,2,4,8)
+ *   -n: iteraciones de las mediciones sin contencion y de latencia
+ *       (por omision 1000000 y su centesima parte)
+ *   -s: numeros de threads en c_wait a interrumpir (por omision
+ *       1000,2000,4000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "kshim.h"
+#include "../kmutex.h"
+
+#define MAX_THREADS 1024
+#define MAX_STORM 65536
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+/*** Sin contencion ***************************************/
+
+static void uncontended(long iters) {
+  KMutex m;
+  double t0, t1;
+  m_init(&m);
+  t0= now_ns();
+  for (long i= 0; i<iters; i++) {
+    m_lock(&m);
+    m_unlock(&m);
+  }
+  t1= now_ns();
+  printf("uncontended m_lock/m_unlock: %.1f ns\n", (t1-t0)/iters);
+}
+
+/*** Con contencion ***************************************/
+
+typedef struct {
+  KMutex m;
+  long counter;          /* protegido por m */
+  double release_time;   /* instante del ultimo m_unlock, protegido por m */
+  int releaser;          /* quien hizo el ultimo m_unlock, protegido por m */
+  volatile int stop;
+} Shared;
+
+typedef struct {
+  Shared *sh;
+  int id;
+  long ops;
+  long handoffs;
+  double handoff_sum, handoff_max;
+} Worker;
+
+static void *contender(void *ptr) {
+  Worker *w= ptr;
+  Shared *sh= w->sh;
+  while (!sh->stop) {
+    m_lock(&sh->m);
+    if (sh->releaser!=w->id && sh->releaser>=0) {
+      double lat= now_ns()-sh->release_time;
+      w->handoffs++;
+      w->handoff_sum+= lat;
+      if (lat>w->handoff_max)
+        w->handoff_max= lat;
+    }
+    sh->counter++;
+    w->ops++;
+    sh->releaser= w->id;
+    sh->release_time= now_ns();
+    m_unlock(&sh->m);
+  }
+  return NULL;
+}
+
+static int contended(int nthreads, int ms) {
+  static Worker workers[MAX_THREADS];
+  pthread_t tids[MAX_THREADS];
+  Shared sh;
+  long total= 0, handoffs= 0, min_ops= -1, max_ops= 0;
+  double handoff_sum= 0, handoff_max= 0, sq= 0, t0, t1;
+
+  m_init(&sh.m);
+  sh.counter= 0;
+  sh.releaser= -1;
+  sh.stop= 0;
+  memset(workers, 0, sizeof(workers));
+  t0= now_ns();
+  for (int i= 0; i<nthreads; i++) {
+    workers[i].sh= &sh;
+    workers[i].id= i;
+    pthread_create(&tids[i], NULL, contender, &workers[i]);
+  }
+  usleep(ms*1000);
+  sh.stop= 1;
+  for (int i= 0; i<nthreads; i++)
+    pthread_join(tids[i], NULL);
+  t1= now_ns();
+
+  for (int i= 0; i<nthreads; i++) {
+    Worker *w= &workers[i];
+    total+= w->ops;
+    sq+= (double)w->ops*w->ops;
+    handoffs+= w->handoffs;
+    handoff_sum+= w->handoff_sum;
+    if (w->handoff_max>handoff_max)
+      handoff_max= w->handoff_max;
+    if (min_ops<0 || w->ops<min_ops)
+      min_ops= w->ops;
+    if (w->ops>max_ops)
+      max_ops= w->ops;
+  }
+  printf("%7d %12.0f %9.1f %12.0f %12.0f %9.3f %8ld/%ld\n",
+         nthreads, total/((t1-t0)/1e9), (t1-t0)/total,
+         handoffs>0 ? handoff_sum/handoffs : 0.0, handoff_max,
+         sq>0 ? (double)total*total/(nthreads*sq) : 1.0, min_ops, max_ops);
+#ifdef KMUTEX_STATS
+  {
+    KMutexStats *st= &sh.m.stats;
+    printf("%7s contended %lu/%lu, wait avg %llu max %llu ns,"
+           " hold avg %llu max %llu ns\n", "", st->contended,
+           st->acquisitions,
+           st->contended>0 ? st->wait_total/st->contended : 0, st->wait_max,
+           st->acquisitions>0 ? st->hold_total/st->acquisitions : 0,
+           st->hold_max);
+  }
+#endif
+  if (sh.counter!=total) {
+    fprintf(stderr, "mutual exclusion violated: counter=%ld expected=%ld\n",
+            sh.counter, total);
+    return -1;
+  }
+  return 0;
+}
+
+/*** Latencia de c_signal *********************************/
+
+typedef struct {
+  KMutex m;
+  KCondition c;
+  int turn;        /* a quien le toca */
+  double stamp;    /* instante del ultimo c_signal */
+  long rounds;
+  double sum, max;
+} PingPong;
+
+static void pingpong_side(PingPong *pp, int me) {
+  m_lock(&pp->m);
+  for (long i= 0; i<pp->rounds; i++) {
+    while (pp->turn!=me)
+      c_wait(&pp->c, &pp->m);
+    if (pp->stamp>0) {
+      double lat= now_ns()-pp->stamp;
+      pp->sum+= lat;
+      if (lat>pp->max)
+        pp->max= lat;
+    }
+    pp->turn= 1-me;
+    pp->stamp= now_ns();
+    c_signal(&pp->c);
+  }
+  m_unlock(&pp->m);
+}
+
+static void *pong(void *ptr) {
+  pingpong_side(ptr, 1);
+  return NULL;
+}
+
+static void signal_latency(long rounds) {
+  PingPong pp;
+  pthread_t tid;
+  m_init(&pp.m);
+  c_init(&pp.c);
+  pp.turn= 0;
+  pp.stamp= 0;
+  pp.rounds= rounds;
+  pp.sum= pp.max= 0;
+  pthread_create(&tid, NULL, pong, &pp);
+  pingpong_side(&pp, 0);
+  pthread_join(tid, NULL);
+  printf("c_signal wake latency: avg %.0f ns, max %.0f ns\n",
+         pp.sum/(2*rounds-1), pp.max);
+}
+
+/*** Latencia de c_broadcast ******************************/
+
+typedef struct {
+  KMutex m;
+  KCondition go, done;
+  int waiting, woken, nwaiters;
+  long gen, rounds;
+  double stamp;
+  double sum, last_sum, max;
+} Broadcast;
+
+static void *bcast_waiter(void *ptr) {
+  Broadcast *b= ptr;
+  m_lock(&b->m);
+  for (long g= 0; g<b->rounds; g++) {
+    double lat;
+    b->waiting++;
+    c_signal(&b->done);
+    while (b->gen==g)
+      c_wait(&b->go, &b->m);
+    lat= now_ns()-b->stamp;
+    b->sum+= lat;
+    if (lat>b->max)
+      b->max= lat;
+    if (++b->woken==b->nwaiters) {
+      b->last_sum+= lat;
+      c_signal(&b->done);
+    }
+  }
+  m_unlock(&b->m);
+  return NULL;
+}
+
+static void broadcast_latency(int nwaiters, long rounds) {
+  Broadcast b;
+  pthread_t tids[MAX_THREADS];
+  m_init(&b.m);
+  c_init(&b.go);
+  c_init(&b.done);
+  b.waiting= b.woken= 0;
+  b.nwaiters= nwaiters;
+  b.gen= 0;
+  b.rounds= rounds;
+  b.sum= b.last_sum= b.max= 0;
+  for (int i= 0; i<nwaiters; i++)
+    pthread_create(&tids[i], NULL, bcast_waiter, &b);
+  m_lock(&b.m);
+  for (long g= 0; g<rounds; g++) {
+    while (b.waiting<nwaiters)
+      c_wait(&b.done, &b.m);
+    b.waiting= 0;
+    b.woken= 0;
+    b.stamp= now_ns();
+    b.gen++;
+    c_broadcast(&b.go);
+    while (b.woken<nwaiters)
+      c_wait(&b.done, &b.m);
+  }
+  m_unlock(&b.m);
+  for (int i= 0; i<nwaiters; i++)
+    pthread_join(tids[i], NULL);
+  printf("c_broadcast to %d waiters: avg %.0f ns, last %.0f ns, max %.0f ns\n",
+         nwaiters, b.sum/(rounds*nwaiters), b.last_sum/rounds, b.max);
+}
+
+/*** Latencia de ec_advance ******************************/
+
+typedef struct {
+  KEventCount ec;
+  volatile int turn; /* a quien le toca, se modifica antes de ec_advance */
+  volatile double stamp;
+  long rounds;
+  double sum, max;
+} EcPingPong;
+
+static void ec_side(EcPingPong *pp, int me) {
+  for (long i= 0; i<pp->rounds; i++) {
+    for (;;) {
+      unsigned long key= ec_read(&pp->ec);
+      if (pp->turn==me)
+        break;
+      ec_await(&pp->ec, key);
+    }
+    if (pp->stamp>0) {
+      double lat= now_ns()-pp->stamp;
+      pp->sum+= lat;
+      if (lat>pp->max)
+        pp->max= lat;
+    }
+    pp->stamp= now_ns();
+    pp->turn= 1-me;
+    ec_advance(&pp->ec);
+  }
+}
+
+static void *ec_pong(void *ptr) {
+  ec_side(ptr, 1);
+  return NULL;
+}
+
+static void eventcount_latency(long rounds) {
+  EcPingPong pp;
+  pthread_t tid;
+  ec_init(&pp.ec);
+  pp.turn= 0;
+  pp.stamp= 0;
+  pp.rounds= rounds;
+  pp.sum= pp.max= 0;
+  pthread_create(&tid, NULL, ec_pong, &pp);
+  ec_side(&pp, 0);
+  pthread_join(tid, NULL);
+  printf("ec_advance wake latency: avg %.0f ns, max %.0f ns\n",
+         pp.sum/(2*rounds-1), pp.max);
+}
+
+/*** Apertura de un KBarrier ******************************/
+
+typedef struct {
+  KBarrier b;
+  long rounds;
+  int serial; /* cuantas veces b_wait retorno 1 */
+} Barrier;
+
+static void *barrier_party(void *ptr) {
+  Barrier *b= ptr;
+  for (long g= 0; g<b->rounds; g++) {
+    if (b_wait(&b->b)==1)
+      __atomic_add_fetch(&b->serial, 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+static int barrier_latency(int nparties, long rounds) {
+  Barrier b;
+  pthread_t tids[MAX_THREADS];
+  double t0, t1;
+  b_init(&b.b, nparties);
+  b.rounds= rounds;
+  b.serial= 0;
+  t0= now_ns();
+  for (int i= 0; i<nparties; i++)
+    pthread_create(&tids[i], NULL, barrier_party, &b);
+  for (int i= 0; i<nparties; i++)
+    pthread_join(tids[i], NULL);
+  t1= now_ns();
+  printf("b_wait with %d parties: %.0f ns per generation\n", nparties,
+         (t1-t0)/rounds);
+  if (b.b.generation!=rounds || b.serial!=rounds) {
+    fprintf(stderr, "barrier broken: generation=%lu serial=%d expected=%ld\n",
+            b.b.generation, b.serial, rounds);
+    return -1;
+  }
+  return 0;
+}
+
+/*** Lectores de un KSeqLock *****************************/
+
+/* Un escritor modifica a y b (siempre iguales) cada 10 us mientras los
+ * lectores los leen sin candado con KSeqLock, o con rw_rlock para
+ * comparar.  Un lector que ve a!=b detecta una copia inconsistente. */
+typedef struct {
+  KSeqLock sq;
+  KRWLock rw;
+  int use_rw;
+  volatile int stop;
+  long a, b;
+  long reads, retries, torn;
+} SeqShared;
+
+static void *seq_writer(void *ptr) {
+  SeqShared *ss= ptr;
+  while (!ss->stop) {
+    if (ss->use_rw) {
+      rw_wlock(&ss->rw);
+      ss->a++;
+      ss->b++;
+      rw_wunlock(&ss->rw);
+    }
+    else {
+      sq_write_lock(&ss->sq);
+      sq_write_begin(&ss->sq);
+      WRITE_ONCE(ss->a, ss->a+1);
+      WRITE_ONCE(ss->b, ss->b+1);
+      sq_write_end(&ss->sq);
+      sq_write_unlock(&ss->sq);
+    }
+    usleep(10);
+  }
+  return NULL;
+}
+
+static void *seq_reader(void *ptr) {
+  SeqShared *ss= ptr;
+  long reads= 0, retries= 0, torn= 0;
+  while (!ss->stop) {
+    long a, b;
+    if (ss->use_rw) {
+      rw_rlock(&ss->rw);
+      a= ss->a;
+      b= ss->b;
+      rw_runlock(&ss->rw);
+    }
+    else {
+      unsigned seq= sq_read_begin(&ss->sq);
+      a= READ_ONCE(ss->a);
+      b= READ_ONCE(ss->b);
+      if (sq_read_retry(&ss->sq, seq)) {
+        retries++;
+        continue;
+      }
+    }
+    if (a!=b)
+      torn++;
+    reads++;
+  }
+  __atomic_add_fetch(&ss->reads, reads, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&ss->retries, retries, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&ss->torn, torn, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+static int seq_readers(int nreaders, int use_rw, int ms) {
+  SeqShared ss;
+  pthread_t tids[MAX_THREADS+1];
+  sq_init(&ss.sq);
+  rw_init(&ss.rw);
+  ss.use_rw= use_rw;
+  ss.stop= 0;
+  ss.a= ss.b= 0;
+  ss.reads= ss.retries= ss.torn= 0;
+  pthread_create(&tids[0], NULL, seq_writer, &ss);
+  for (int i= 1; i<=nreaders; i++)
+    pthread_create(&tids[i], NULL, seq_reader, &ss);
+  usleep(ms*1000);
+  ss.stop= 1;
+  for (int i= 0; i<=nreaders; i++)
+    pthread_join(tids[i], NULL);
+  printf("%s with %d readers and 1 writer: %.0f reads/s, %ld retries, "
+         "%ld writes\n", use_rw ? "rw_rlock" : "sq_read_begin", nreaders,
+         ss.reads*1000.0/ms, ss.retries, ss.a);
+  if (ss.torn>0) {
+    fprintf(stderr, "%ld inconsistent reads\n", ss.torn);
+    return -1;
+  }
+  return 0;
+}
+
+/*** Modo prioridad *************************************/
+
+typedef struct {
+  KMutex m;
+  volatile int stop;
+  long counter;  /* protegido por m */
+  int unboosted; /* threads normales que terminaron sin prioridad heredada */
+} PrioShared;
+
+static void *batch(void *ptr) {
+  PrioShared *ps= ptr;
+  while (!ps->stop) {
+    double t0;
+    m_lock(&ps->m);
+    ps->counter++;
+    t0= now_ns();
+    while (now_ns()-t0<2000) /* 2 us de trabajo con el mutex */
+      ;
+    m_unlock(&ps->m);
+  }
+  if (current->prio==DEFAULT_PRIO)
+    __atomic_add_fetch(&ps->unboosted, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+static int prio_latency(int nbatch, unsigned flags, long rounds) {
+  PrioShared ps;
+  pthread_t tids[MAX_THREADS];
+  struct sched_attr rt= { sizeof(rt), SCHED_FIFO, 0, 0, 50 };
+  struct sched_attr normal= { sizeof(normal), SCHED_NORMAL, 0, 0, 0 };
+  double sum= 0, max= 0;
+
+  m_init_flags(&ps.m, flags);
+  ps.stop= 0;
+  ps.counter= 0;
+  ps.unboosted= 0;
+  for (int i= 0; i<nbatch; i++)
+    pthread_create(&tids[i], NULL, batch, &ps);
+  sched_setattr_nocheck(current, &rt);
+  for (long i= 0; i<rounds; i++) {
+    double t0= now_ns(), lat;
+    m_lock(&ps.m);
+    lat= now_ns()-t0;
+    m_unlock(&ps.m);
+    sum+= lat;
+    if (lat>max)
+      max= lat;
+    usleep(100);
+  }
+  sched_setattr_nocheck(current, &normal);
+  ps.stop= 1;
+  for (int i= 0; i<nbatch; i++)
+    pthread_join(tids[i], NULL);
+  printf("real-time m_lock with %d busy threads (%s): avg %.0f ns, max %.0f ns\n",
+         nbatch, flags & KMUTEX_PRIO ? "priority" : "fifo", sum/rounds, max);
+  if (ps.unboosted!=nbatch) {
+    fprintf(stderr, "priority inheritance not undone in %d threads\n",
+            nbatch-ps.unboosted);
+    return -1;
+  }
+  return 0;
+}
+
+/*** Senales a threads en c_wait *************************/
+
+/* n threads esperan en c_wait y se les envia SIGUSR1 a todos a la vez.
+ * Cada uno saca su link de la cola de la condicion, lo que es O(1), y
+ * vuelve a pedir el mutex.  Si sacar el link fuese O(n), el tiempo por
+ * thread y el tiempo de posesion del mutex (que KMUTEX_STATS mide desde
+ * que c_wait lo vuelve a obtener) crecerian con n. */
+
+typedef struct {
+  KMutex m;
+  KCondition c;
+  int waiting;     /* threads que llegaron a c_wait, protegido por m */
+  int interrupted; /* threads que retornaron -EINTR, protegido por m */
+  double last;     /* instante en que retorno el ultimo, protegido por m */
+} Storm;
+
+typedef struct {
+  Storm *st;
+  pthread_t tid;
+  volatile int done;
+} StormWaiter;
+
+static void storm_handler(int sig) {
+}
+
+static void *storm_waiter(void *ptr) {
+  StormWaiter *w= ptr;
+  Storm *st= w->st;
+  m_lock(&st->m);
+  st->waiting++;
+  if (c_wait(&st->c, &st->m)==-EINTR)
+    st->interrupted++;
+  st->last= now_ns();
+  m_unlock(&st->m);
+  w->done= 1;
+  return NULL;
+}
+
+static int signal_storm(int n) {
+  Storm st;
+  StormWaiter *ws= calloc(n, sizeof(StormWaiter));
+  pthread_attr_t attr;
+  struct sigaction sa;
+  double t0, sent;
+  int created, resent= 0;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler= storm_handler; /* sin SA_RESTART: sem_wait retorna EINTR */
+  sigaction(SIGUSR1, &sa, NULL);
+  m_init(&st.m);
+  c_init(&st.c);
+  st.waiting= st.interrupted= 0;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+  for (created= 0; created<n; created++) {
+    ws[created].st= &st;
+    if (pthread_create(&ws[created].tid, &attr, storm_waiter,
+                       &ws[created])!=0)
+      break;
+  }
+  if (created<n) {
+    fprintf(stderr, "could only create %d threads\n", created);
+    n= created;
+  }
+  for (;;) {
+    int waiting;
+    m_lock(&st.m);
+    waiting= st.waiting;
+    m_unlock(&st.m);
+    if (waiting==n)
+      break;
+    usleep(1000);
+  }
+  usleep(100*1000); /* da tiempo a que el ultimo se duerma en c_wait */
+#ifdef KMUTEX_STATS
+  m_lock(&st.m);
+  memset(&st.m.stats, 0, sizeof(st.m.stats));
+  st.m.stats.acquired_at= ktime_get_ns();
+  m_unlock(&st.m);
+#endif
+
+  t0= sent= now_ns();
+  for (int i= 0; i<n; i++)
+    pthread_kill(ws[i].tid, SIGUSR1);
+  /* Una senal que llega justo antes de que el thread se duerma se pierde:
+   * se reenvia a quienes no hayan salido en un segundo */
+  for (;;) {
+    int left= 0;
+    for (int i= 0; i<n; i++)
+      left+= !ws[i].done;
+    if (left==0)
+      break;
+    if (now_ns()-sent>1e9) {
+      for (int i= 0; i<n; i++) {
+        if (!ws[i].done) {
+          pthread_kill(ws[i].tid, SIGUSR1);
+          resent++;
+        }
+      }
+      sent= now_ns();
+    }
+    usleep(1000);
+  }
+  for (int i= 0; i<n; i++)
+    pthread_join(ws[i].tid, NULL);
+  pthread_attr_destroy(&attr);
+  free(ws);
+
+  printf("c_wait interrupted in %d threads: %.3f ms, %.0f ns per thread",
+         n, (st.last-t0)/1e6, (st.last-t0)/n);
+  if (resent>0)
+    printf(" (%d signals resent)", resent);
+  printf("\n");
+#ifdef KMUTEX_STATS
+  {
+    KMutexStats *s= &st.m.stats;
+    printf("%7s contended %lu/%lu, hold avg %llu max %llu ns\n", "",
+           s->contended, s->acquisitions,
+           s->acquisitions>0 ? s->hold_total/s->acquisitions : 0,
+           s->hold_max);
+  }
+#endif
+  if (st.interrupted!=n) {
+    fprintf(stderr, "%d threads left c_wait without -EINTR\n",
+            n-st.interrupted);
+    return -1;
+  }
+  return 0;
+}
+
+/*** Programa principal ***********************************/
+
+int main(int argc, char *argv[]) {
+  int ms= 1000;
+  long iters= 1000000;
+  char default_list[]= "1,2,4,8", *list= default_list;
+  char default_storms[]= "1000,2000,4000", *storm_list= default_storms;
+  int threads[MAX_THREADS], nlist= 0, maxthreads= 1;
+  int storms[MAX_THREADS], nstorms= 0;
+  int opt;
+
+  while ((opt= getopt(argc, argv, "d:t:n:s:"))!=-1) {
+    switch (opt) {
+    case 'd': ms= atoi(optarg); break;
+    case 't': list= optarg; break;
+    case 'n': iters= atol(optarg); break;
+    case 's': storm_list= optarg; break;
+    default:
+      fprintf(stderr, "usage: %s [-d ms] [-t n1,n2,...] [-n iterations] "
+              "[-s n1,n2,...]\n", argv[0]);
+      return 2;
+    }
+  }
+  for (char *p= strtok(list, ","); p!=NULL && nlist<MAX_THREADS;
+       p= strtok(NULL, ",")) {
+    int n= atoi(p);
+    if (n<1 || n>MAX_THREADS) {
+      fprintf(stderr, "invalid number of threads: %s\n", p);
+      return 2;
+    }
+    threads[nlist++]= n;
+    if (n>maxthreads)
+      maxthreads= n;
+  }
+  for (char *p= strtok(storm_list, ","); p!=NULL && nstorms<MAX_THREADS;
+       p= strtok(NULL, ",")) {
+    int n= atoi(p);
+    if (n<1 || n>MAX_STORM) {
+      fprintf(stderr, "invalid number of threads: %s\n", p);
+      return 2;
+    }
+    storms[nstorms++]= n;
+  }
+
+#ifdef KMUTEX_MCS
+  printf("KMutex: MCS queue\n");
+#else
+  printf("KMutex: semaphore\n");
+#endif
+  uncontended(iters);
+  printf("%7s %12s %9s %12s %12s %9s %8s\n", "threads", "ops/s", "ns/op",
+         "handoff-avg", "handoff-max", "fairness", "min/max");
+  for (int i= 0; i<nlist; i++) {
+    if (contended(threads[i], ms)<0)
+      return 1;
+  }
+  signal_latency(iters/100>0 ? iters/100 : 1);
+  broadcast_latency(maxthreads>1 ? maxthreads-1 : 1,
+                    iters/1000>0 ? iters/1000 : 1);
+  eventcount_latency(iters/100>0 ? iters/100 : 1);
+  if (barrier_latency(maxthreads>1 ? maxthreads : 2,
+                      iters/1000>0 ? iters/1000 : 1)<0)
+    return 1;
+  for (int use_rw= 0; use_rw<=1; use_rw++) {
+    if (seq_readers(maxthreads, use_rw, ms)<0)
+      return 1;
+  }
+  for (unsigned flags= 0; flags<=KMUTEX_PRIO; flags+= KMUTEX_PRIO) {
+    if (prio_latency(maxthreads>1 ? maxthreads-1 : 1, flags,
+                     iters/1000>0 ? iters/1000 : 1)<0)
+      return 1;
+  }
+  for (int i= 0; i<nstorms; i++) {
+    if (signal_storm(storms[i])<0)
+      return 1;
+  }
+  return 0;
+}
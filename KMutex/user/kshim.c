@@ -0,0 +1,299 @@
+/* Implementacion en modo usuario de la API del nucleo declarada en kshim.h */
+
+#define _GNU_SOURCE /* sem_clockwait */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h> /* sysconf */
+
+#include "kshim.h"
+
+__thread struct task_struct *kshim_task;
+
+/* El descriptor de un thread no se libera cuando termina (ver kshim.h) */
+struct task_struct *kshim_new_task(void) {
+  struct task_struct *task= malloc(sizeof(*task));
+  int on_cpu= sysconf(_SC_NPROCESSORS_ONLN)>1;
+  *task= (struct task_struct){ on_cpu, DEFAULT_PRIO, SCHED_NORMAL };
+  kshim_task= task;
+  return task;
+}
+
+int sched_setattr_nocheck(struct task_struct *task,
+                          const struct sched_attr *attr) {
+  task->policy= attr->sched_policy;
+  task->rt_priority= attr->sched_priority;
+  task->nice= attr->sched_nice;
+  if (task->policy==SCHED_FIFO || task->policy==SCHED_RR)
+    task->prio= MAX_RT_PRIO-1-task->rt_priority;
+  else
+    task->prio= DEFAULT_PRIO+task->nice;
+  return 0;
+}
+
+u64 ktime_get_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long kshim_jiffies(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*HZ + ts.tv_nsec/(1000000000/HZ);
+}
+
+/* Los temporizadores armados, sin orden, y el thread que los expira.
+ * timer_cond despierta al thread cuando se arma uno y a timer_delete_sync
+ * cuando termina una funcion. */
+#define TIMER_IDLE 0
+#define TIMER_PENDING 1
+#define TIMER_RUNNING 2
+static pthread_mutex_t timer_lock= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static pthread_once_t timer_once= PTHREAD_ONCE_INIT;
+static struct timer_list *timers;
+
+static void *timer_thread(void *ptr) {
+  pthread_mutex_lock(&timer_lock);
+  for (;;) {
+    struct timer_list **pnext, **pfirst= NULL;
+    for (pnext= &timers; *pnext!=NULL; pnext= &(*pnext)->next) {
+      if (pfirst==NULL || time_after((*pfirst)->expires, (*pnext)->expires))
+        pfirst= pnext;
+    }
+    if (pfirst==NULL)
+      pthread_cond_wait(&timer_cond, &timer_lock);
+    else if (time_after_eq(jiffies, (*pfirst)->expires)) {
+      struct timer_list *timer= *pfirst;
+      *pfirst= timer->next;
+      timer->state= TIMER_RUNNING;
+      pthread_mutex_unlock(&timer_lock);
+      timer->function(timer);
+      pthread_mutex_lock(&timer_lock);
+      timer->state= TIMER_IDLE;
+      pthread_cond_broadcast(&timer_cond);
+    }
+    else {
+      unsigned long expires= (*pfirst)->expires;
+      struct timespec ts= { expires/HZ, (expires%HZ)*(1000000000/HZ) };
+      pthread_cond_timedwait(&timer_cond, &timer_lock, &ts);
+    }
+  }
+  return NULL;
+}
+
+static void timer_start(void) {
+  pthread_condattr_t attr;
+  pthread_t thread;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); /* como jiffies */
+  pthread_cond_init(&timer_cond, &attr);
+  pthread_create(&thread, NULL, timer_thread, NULL);
+  pthread_detach(thread);
+}
+
+void timer_setup(struct timer_list *timer,
+                 void (*function)(struct timer_list *timer), unsigned flags) {
+  timer->function= function;
+  timer->state= TIMER_IDLE;
+}
+
+int mod_timer(struct timer_list *timer, unsigned long expires) {
+  pthread_once(&timer_once, timer_start);
+  pthread_mutex_lock(&timer_lock);
+  timer->expires= expires;
+  timer->state= TIMER_PENDING;
+  timer->next= timers;
+  timers= timer;
+  pthread_cond_broadcast(&timer_cond);
+  pthread_mutex_unlock(&timer_lock);
+  return 0;
+}
+
+/* Retorna 1 si desarmo el temporizador antes de que expirara, y 0 si la
+ * funcion ya se invoco (y termino) */
+int timer_delete_sync(struct timer_list *timer) {
+  int pending;
+  pthread_mutex_lock(&timer_lock);
+  while (timer->state==TIMER_RUNNING)
+    pthread_cond_wait(&timer_cond, &timer_lock);
+  pending= timer->state==TIMER_PENDING;
+  if (pending) {
+    struct timer_list **pnext= &timers;
+    while (*pnext!=timer)
+      pnext= &(*pnext)->next;
+    *pnext= timer->next;
+    timer->state= TIMER_IDLE;
+  }
+  pthread_mutex_unlock(&timer_lock);
+  return pending;
+}
+
+void destroy_timer_on_stack(struct timer_list *timer) {
+}
+
+void sema_init(struct semaphore *sem, int val) {
+  sem_init(&sem->sem, 0, val);
+}
+
+void down(struct semaphore *sem) {
+  while (sem_wait(&sem->sem)!=0)
+    ;
+}
+
+int down_interruptible(struct semaphore *sem) {
+  return sem_wait(&sem->sem)==0 ? 0 : -EINTR;
+}
+
+int down_killable(struct semaphore *sem) {
+  down(sem);
+  return 0;
+}
+
+int down_timeout(struct semaphore *sem, long timeout) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ts.tv_sec+= timeout/HZ;
+  ts.tv_nsec+= (timeout%HZ)*(1000000000/HZ);
+  if (ts.tv_nsec>=1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec-= 1000000000;
+  }
+  while (sem_clockwait(&sem->sem, CLOCK_MONOTONIC, &ts)!=0) {
+    if (errno==ETIMEDOUT)
+      return -ETIME;
+  }
+  return 0;
+}
+
+int down_trylock(struct semaphore *sem) {
+  return sem_trywait(&sem->sem)==0 ? 0 : 1;
+}
+
+void up(struct semaphore *sem) {
+  sem_post(&sem->sem);
+}
+
+int kshim_quiet= 0;
+
+int printk(const char *fmt, ...) {
+  va_list ap;
+  int rc;
+  if (kshim_quiet)
+    return 0;
+  va_start(ap, fmt);
+  rc= vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  return rc;
+}
+
+static struct kshim_param *params= NULL;
+
+void kshim_param_register(struct kshim_param *param) {
+  param->next= params;
+  params= param;
+}
+
+int kshim_set_param(const char *name, int value) {
+  struct kshim_param *param;
+  for (param= params; param!=NULL; param= param->next) {
+    if (strcmp(param->name, name)==0) {
+      *param->value= value;
+      return 0;
+    }
+  }
+  return -EINVAL;
+}
+
+/* Copia bytes entre addr y los segmentos de i, avanzando i */
+static size_t copy_iter(void *addr, size_t bytes, struct iov_iter *i,
+                        int to_iter) {
+  size_t copied= 0;
+  if (bytes>i->count)
+    bytes= i->count;
+  while (copied<bytes) {
+    size_t n= i->iov->iov_len-i->iov_offset;
+    char *base= (char *)i->iov->iov_base+i->iov_offset;
+    if (n>bytes-copied)
+      n= bytes-copied;
+    if (to_iter)
+      memcpy(base, (const char *)addr+copied, n);
+    else
+      memcpy((char *)addr+copied, base, n);
+    copied+= n;
+    i->iov_offset+= n;
+    if (i->iov_offset==i->iov->iov_len && i->nr_segs>1) {
+      i->iov++;
+      i->nr_segs--;
+      i->iov_offset= 0;
+    }
+  }
+  i->count-= copied;
+  return copied;
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i) {
+  return copy_iter((void *)addr, bytes, i, 1);
+}
+
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i) {
+  return copy_iter(addr, bytes, i, 0);
+}
+
+/* Como en el nucleo, si el driver no define read (write) se usa read_iter
+ * (write_iter) con un iov_iter de un solo segmento */
+static ssize_t rw_iter(struct file *filp, const struct iovec *iov,
+                       int iovcnt, loff_t *pos, int write) {
+  struct kiocb kiocb= { filp, 0, *pos };
+  struct iov_iter iter;
+  size_t count= 0;
+  ssize_t rc;
+  for (int k= 0; k<iovcnt; k++)
+    count+= iov[k].iov_len;
+  iov_iter_init(&iter, write ? ITER_SOURCE : ITER_DEST, iov, iovcnt, count);
+  rc= write ? filp->f_op->write_iter(&kiocb, &iter) :
+              filp->f_op->read_iter(&kiocb, &iter);
+  *pos= kiocb.ki_pos;
+  return rc;
+}
+
+ssize_t vfs_read(struct file *filp, char *buf, size_t count, loff_t *pos) {
+  struct iovec iov= { buf, count };
+  if (filp->f_op->read)
+    return filp->f_op->read(filp, buf, count, pos);
+  return rw_iter(filp, &iov, 1, pos, 0);
+}
+
+ssize_t vfs_write(struct file *filp, const char *buf, size_t count,
+                  loff_t *pos) {
+  struct iovec iov= { (char *)buf, count };
+  if (filp->f_op->write)
+    return filp->f_op->write(filp, buf, count, pos);
+  return rw_iter(filp, &iov, 1, pos, 1);
+}
+
+ssize_t vfs_readv(struct file *filp, const struct iovec *iov, int iovcnt,
+                  loff_t *pos) {
+  return rw_iter(filp, iov, iovcnt, pos, 0);
+}
+
+ssize_t vfs_writev(struct file *filp, const struct iovec *iov, int iovcnt,
+                   loff_t *pos) {
+  return rw_iter(filp, iov, iovcnt, pos, 1);
+}
+
+void *vfs_mmap(struct file *filp, size_t length, struct vm_area_struct *vma) {
+  memset(vma, 0, sizeof(*vma));
+  vma->vm_end= length;
+  vma->vm_flags= VM_SHARED;
+  if (filp->f_op->mmap==NULL || filp->f_op->mmap(filp, vma)<0)
+    return NULL;
+  return (void *)vma->vm_start;
+}
+
+void vfs_munmap(struct vm_area_struct *vma) {
+  if (vma->vm_ops && vma->vm_ops->close)
+    vma->vm_ops->close(vma);
+}
@@ -0,0 +1,479 @@
+/* Implementacion en modo usuario de la parte de la API del nucleo de Linux
+ * que usa kmutex.c, para compilar exactamente el mismo kmutex.c como un
+ * programa corriente y asi medirlo o probarlo sin cargar un modulo.
+ * Tambien incluye lo que necesita un driver sencillo como ../../Pipe para
+ * que sus funciones read y write se puedan invocar desde un thread.
+ *
+ * Los archivos linux/xxx.h de este directorio solo incluyen este archivo,
+ * de modo que basta compilar ../kmutex.c con -I. para que todos sus
+ * #include <linux/...> lleguen aqui.
+ *
+ * Diferencias con el nucleo:
+ * - struct semaphore es un sem_t de POSIX (implementado con futex).
+ * - spinlock_t es un pthread_mutex_t: en modo usuario no se puede impedir
+ *   que el dueno de un spinlock sea desplazado de la CPU, y un spinlock
+ *   de verdad degeneraria con mas threads que CPUs.
+ * - current es un struct task_struct por thread, que se considera en
+ *   ejecucion (on_cpu==1) salvo si hay una sola CPU: entonces el thread
+ *   que consulta a otro es el que esta en ejecucion.  En el nucleo RCU
+ *   impide que se libere el descriptor de un proceso que termina mientras
+ *   otro lo consulta (p.ej. el dueno de un mutex, ver spin en
+ *   ../kmutex.c); aqui nunca se libera.
+ * - la prioridad de un proceso (prio, policy, ...) solo se registra en su
+ *   struct task_struct: sched_setattr_nocheck no cambia la prioridad con
+ *   que el sistema planifica el thread.
+ * - jiffies cuenta milisegundos (HZ==1000).
+ * - un solo thread invoca las funciones de todos los temporizadores
+ *   (struct timer_list).  mod_timer solo arma un temporizador inactivo.
+ * - down_killable no se distingue de down: en modo usuario no hay
+ *   senales fatales que atrapar.
+ * - no hay debugfs (CONFIG_DEBUG_FS no esta definido).
+ * - preempt_disable no hace nada: un thread siempre puede ser desplazado.
+ *   Por eso smp_cond_load_relaxed cede la CPU en cada intento: en el
+ *   nucleo la cola MCS (ver acquire en ../kmutex.c) la usa para esperar a
+ *   un proceso que se esta encolando con preempt_disable, por unas pocas
+ *   instrucciones, pero aqui ese thread pudo ser desplazado y esperarlo
+ *   activamente gastaria toda una tajada de tiempo.
+ * - no hay lockdep ni KCSAN: sus anotaciones no hacen nada.
+ * - register_chrdev y cdev_add no crean ningun dispositivo: el programa
+ *   invoca directamente las funciones del struct file_operations del
+ *   driver, con un struct inode cuyo i_rdev indica el minor, y
+ *   copy_to_user/copy_from_user son memcpy.  vfs_read y vfs_write hacen
+ *   lo que read(2) y write(2): usan read/write o read_iter/write_iter
+ *   segun lo que defina filp->f_op.  vfs_readv y vfs_writev, como
+ *   readv(2) y writev(2), requieren read_iter/write_iter.
+ * - un iov_iter solo puede recorrer un arreglo de struct iovec, y no hay
+ *   splice: copy_splice_read e iter_file_splice_write son NULL.
+ * - no hay procesos de 32 bits: CONFIG_COMPAT no esta definido.
+ * - el programa y el driver comparten el espacio de direcciones: vfs_mmap
+ *   invoca la funcion mmap del driver y remap_vmalloc_range solo hace que
+ *   la proyeccion apunte al area, sin copiar ni proyectar nada.
+ * - module_param solo acepta parametros int, que se fijan con
+ *   kshim_set_param antes de invocar la funcion de inicializacion.
+ * - printk no escribe nada si kshim_quiet no es 0.
+ * - send_sig solo puede enviar una senal a current: es raise(3), que la
+ *   envia al thread que la invoca.
+ * - no hay poll ni select: poll_wait y wake_up_interruptible_poll no
+ *   hacen nada y ninguna cola tiene procesos (waitqueue_active), pero se
+ *   puede invocar la funcion poll de un driver para saber que eventos
+ *   reporta.
+ */
+
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h> /* uintptr_t */
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h> /* ssize_t, loff_t */
+#include <sys/uio.h> /* struct iovec */
+#include <sys/epoll.h> /* EPOLLIN, ... */
+#include <fcntl.h> /* O_NONBLOCK */
+#include <signal.h> /* SIGPIPE, raise */
+
+#define CONFIG_SMP 1
+#define HZ 1000
+
+typedef unsigned long long u64;
+typedef unsigned int __u32;
+typedef unsigned long long __u64;
+
+#define container_of(ptr, type, member) \
+  ((type *)((char *)(ptr)-offsetof(type, member)))
+
+/* Procesos */
+
+#ifndef SCHED_NORMAL
+#define SCHED_NORMAL 0
+#endif
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#define MAX_RT_PRIO 100
+#define DEFAULT_PRIO 120
+
+struct task_struct {
+  int on_cpu;
+  int prio;        /* < MAX_RT_PRIO para tiempo real, menor es mas urgente */
+  int policy;
+  int rt_priority;
+  int nice;
+};
+
+struct sched_attr {
+  unsigned size;
+  unsigned sched_policy;
+  unsigned long long sched_flags;
+  int sched_nice;
+  unsigned sched_priority;
+};
+
+int sched_setattr_nocheck(struct task_struct *task,
+                          const struct sched_attr *attr);
+#define rt_prio(prio) ((prio)<MAX_RT_PRIO)
+#define task_nice(task) ((task)->nice)
+
+extern __thread struct task_struct *kshim_task;
+struct task_struct *kshim_new_task(void);
+static inline struct task_struct *kshim_current(void) {
+  return kshim_task!=NULL ? kshim_task : kshim_new_task();
+}
+#define current (kshim_current())
+
+static inline int send_sig(int sig, struct task_struct *task, int priv) {
+  return raise(sig);
+}
+
+static inline int need_resched(void) { return 0; }
+static inline void might_sleep(void) { }
+static inline int task_cpu(struct task_struct *task) { return 0; }
+static inline int vcpu_is_preempted(int cpu) { return 0; }
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield" ::: "memory");
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* Accesos concurrentes y RCU */
+
+#define READ_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x)= (val))
+
+#define xchg(ptr, val) __atomic_exchange_n((ptr), (val), __ATOMIC_SEQ_CST)
+#define cmpxchg(ptr, old, val) ({ \
+  __typeof__(*(ptr)) __old= (old); \
+  __atomic_compare_exchange_n((ptr), &__old, (val), 0, __ATOMIC_SEQ_CST, \
+                              __ATOMIC_SEQ_CST); \
+  __old; })
+
+typedef struct { int counter; } atomic_t;
+#define ATOMIC_INIT(i) { (i) }
+#define atomic_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_inc(v) __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_RELAXED)
+#define atomic_dec(v) __atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_RELAXED)
+
+#define smp_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, val) __atomic_store_n((p), (val), __ATOMIC_RELEASE)
+
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#define data_race(expr) (expr)
+#define kcsan_atomic_next(n) do { } while (0)
+
+static inline void preempt_disable(void) { }
+static inline void preempt_enable(void) { }
+
+#define smp_cond_load_relaxed(ptr, cond_expr) ({ \
+  __typeof__(*(ptr)) VAL; \
+  while (VAL= READ_ONCE(*(ptr)), !(cond_expr)) \
+    sched_yield(); \
+  VAL; })
+
+static inline void rcu_read_lock(void) { }
+static inline void rcu_read_unlock(void) { }
+
+/* Tiempo */
+
+u64 ktime_get_ns(void);
+unsigned long kshim_jiffies(void);
+#define jiffies kshim_jiffies()
+#define msecs_to_jiffies(ms) ((unsigned long)(ms))
+#define time_after(a, b) ((long)((b)-(a))<0)
+#define time_after_eq(a, b) ((long)((a)-(b))>=0)
+
+struct timer_list {
+  void (*function)(struct timer_list *timer);
+  unsigned long expires;
+  int state;                /* inactivo, armado o invocando function */
+  struct timer_list *next;  /* en la lista de temporizadores armados */
+};
+
+void timer_setup(struct timer_list *timer,
+                 void (*function)(struct timer_list *timer), unsigned flags);
+#define timer_setup_on_stack timer_setup
+int mod_timer(struct timer_list *timer, unsigned long expires);
+int timer_delete_sync(struct timer_list *timer);
+void destroy_timer_on_stack(struct timer_list *timer);
+
+/* Semaforos y spinlocks */
+
+struct semaphore {
+  sem_t sem;
+};
+
+void sema_init(struct semaphore *sem, int val);
+void down(struct semaphore *sem);
+int down_interruptible(struct semaphore *sem);
+int down_killable(struct semaphore *sem);
+int down_timeout(struct semaphore *sem, long timeout);
+int down_trylock(struct semaphore *sem);
+void up(struct semaphore *sem);
+
+typedef pthread_mutex_t spinlock_t;
+
+#define spin_lock_init(lock) pthread_mutex_init((lock), NULL)
+#define spin_lock(lock) pthread_mutex_lock(lock)
+#define spin_unlock(lock) pthread_mutex_unlock(lock)
+
+struct mutex {
+  pthread_mutex_t m;
+};
+
+#define mutex_init(mutex) pthread_mutex_init(&(mutex)->m, NULL)
+#define mutex_lock(mutex) pthread_mutex_lock(&(mutex)->m)
+#define mutex_unlock(mutex) pthread_mutex_unlock(&(mutex)->m)
+
+/* lockdep (CONFIG_DEBUG_LOCK_ALLOC no esta definido) */
+
+#define _RET_IP_ ((unsigned long)__builtin_return_address(0))
+#define mutex_acquire(map, subclass, trylock, ip) do { } while (0)
+#define mutex_release(map, ip) do { } while (0)
+
+/* Mensajes */
+
+extern int kshim_quiet;
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+/* Como en el nucleo sin DEBUG: solo revisa el formato */
+#define pr_debug(fmt, ...) \
+  do { if (0) printk(fmt, ##__VA_ARGS__); } while (0)
+
+/* Modulos y drivers */
+
+#define __user
+
+struct kshim_param {
+  const char *name;
+  int *value;
+  struct kshim_param *next;
+};
+
+void kshim_param_register(struct kshim_param *param);
+int kshim_set_param(const char *name, int value); /* -EINVAL si no existe */
+
+#define module_param(name, type, perm) \
+  static struct kshim_param kshim_param_##name= { #name, &(name) }; \
+  static void __attribute__((constructor)) kshim_init_##name(void) { \
+    kshim_param_register(&kshim_param_##name); \
+  } \
+  struct kshim_param_unused_##name
+#define MODULE_PARM_DESC(name, desc) struct kshim_param_unused_##name
+#define MODULE_LICENSE(license) struct kshim_module_unused
+#define module_init(fn) struct kshim_module_unused
+#define module_exit(fn) struct kshim_module_unused
+
+#define FMODE_READ 0x1
+#define FMODE_WRITE 0x2
+
+#define THIS_MODULE NULL
+
+#define MINORBITS 20
+#define MKDEV(major, minor) (((major)<<MINORBITS) | (minor))
+#define MINOR(dev) ((unsigned)((dev) & ((1U<<MINORBITS)-1)))
+
+struct inode {
+  dev_t i_rdev;
+};
+
+static inline unsigned iminor(const struct inode *inode) {
+  return MINOR(inode->i_rdev);
+}
+
+struct file_operations;
+
+struct file {
+  unsigned f_mode;
+  unsigned f_flags;
+  void *private_data;
+  const struct file_operations *f_op;
+};
+
+/* Lecturas y escrituras vectoriales */
+
+#define ITER_DEST 0   /* se copia hacia el iov_iter (read) */
+#define ITER_SOURCE 1 /* se copia desde el iov_iter (write) */
+
+struct iov_iter {
+  const struct iovec *iov; /* el segmento actual */
+  unsigned long nr_segs;   /* los segmentos que quedan */
+  size_t iov_offset;       /* lo ya copiado del segmento actual */
+  size_t count;            /* lo que queda por copiar */
+  struct iovec __ubuf_iovec; /* el unico segmento de import_ubuf */
+};
+
+static inline void iov_iter_init(struct iov_iter *i, unsigned direction,
+                                 const struct iovec *iov,
+                                 unsigned long nr_segs, size_t count) {
+  i->iov= iov;
+  i->nr_segs= nr_segs;
+  i->iov_offset= 0;
+  i->count= count;
+}
+static inline int import_ubuf(int direction, void *buf, size_t len,
+                              struct iov_iter *i) {
+  i->__ubuf_iovec.iov_base= buf;
+  i->__ubuf_iovec.iov_len= len;
+  iov_iter_init(i, direction, &i->__ubuf_iovec, 1, len);
+  return 0;
+}
+static inline size_t iov_iter_count(const struct iov_iter *i) {
+  return i->count;
+}
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i);
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i);
+
+#define IOCB_NOWAIT 0x1
+
+struct kiocb {
+  struct file *ki_filp;
+  int ki_flags;
+  loff_t ki_pos;
+};
+
+struct pipe_inode_info;
+#define copy_splice_read NULL
+#define iter_file_splice_write NULL
+
+/* Proyecciones en memoria */
+
+#define VM_SHARED 0x8
+
+struct vm_area_struct;
+
+struct vm_operations_struct {
+  void (*open)(struct vm_area_struct *vma);
+  void (*close)(struct vm_area_struct *vma);
+};
+
+struct vm_area_struct {
+  unsigned long vm_start, vm_end; /* vm_end-vm_start bytes proyectados */
+  unsigned long vm_pgoff;
+  unsigned long vm_flags;
+  const struct vm_operations_struct *vm_ops;
+  void *vm_private_data;
+};
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma,
+                                      void *addr, unsigned long pgoff) {
+  vma->vm_end= (unsigned long)addr+(vma->vm_end-vma->vm_start);
+  vma->vm_start= (unsigned long)addr;
+  return 0;
+}
+
+typedef unsigned __poll_t;
+typedef struct poll_table_struct poll_table;
+
+typedef struct {
+  int unused;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq) { }
+static inline int waitqueue_active(wait_queue_head_t *wq) { return 0; }
+static inline void poll_wait(struct file *filp, wait_queue_head_t *wq,
+                             poll_table *wait) { }
+static inline void wake_up_interruptible_poll(wait_queue_head_t *wq,
+                                              __poll_t mask) { }
+
+struct file_operations {
+  ssize_t (*read)(struct file *filp, char *buf, size_t count, loff_t *f_pos);
+  ssize_t (*write)(struct file *filp, const char *buf, size_t count,
+                   loff_t *f_pos);
+  ssize_t (*read_iter)(struct kiocb *iocb, struct iov_iter *to);
+  ssize_t (*write_iter)(struct kiocb *iocb, struct iov_iter *from);
+  ssize_t (*splice_read)(struct file *in, loff_t *ppos,
+                         struct pipe_inode_info *pipe, size_t len,
+                         unsigned int flags);
+  ssize_t (*splice_write)(struct pipe_inode_info *pipe, struct file *out,
+                          loff_t *ppos, size_t len, unsigned int flags);
+  long (*unlocked_ioctl)(struct file *filp, unsigned int cmd,
+                         unsigned long arg);
+  __poll_t (*poll)(struct file *filp, poll_table *wait);
+  int (*mmap)(struct file *filp, struct vm_area_struct *vma);
+  int (*open)(struct inode *inode, struct file *filp);
+  int (*release)(struct inode *inode, struct file *filp);
+};
+
+/* read(2) y write(2) sobre un archivo abierto */
+ssize_t vfs_read(struct file *filp, char *buf, size_t count, loff_t *pos);
+ssize_t vfs_write(struct file *filp, const char *buf, size_t count,
+                  loff_t *pos);
+ssize_t vfs_readv(struct file *filp, const struct iovec *iov, int iovcnt,
+                  loff_t *pos);
+ssize_t vfs_writev(struct file *filp, const struct iovec *iov, int iovcnt,
+                   loff_t *pos);
+
+/* mmap(2) con MAP_SHARED de length bytes de un archivo abierto y
+ * munmap(2).  vfs_mmap describe la proyeccion en *vma y retorna su
+ * direccion, o NULL si el driver la rechaza. */
+void *vfs_mmap(struct file *filp, size_t length, struct vm_area_struct *vma);
+void vfs_munmap(struct vm_area_struct *vma);
+
+static inline int register_chrdev(unsigned major, const char *name,
+                                  const struct file_operations *fops) {
+  return 0;
+}
+static inline void unregister_chrdev(unsigned major, const char *name) { }
+
+static inline int register_chrdev_region(dev_t from, unsigned count,
+                                         const char *name) {
+  return 0;
+}
+static inline void unregister_chrdev_region(dev_t from, unsigned count) { }
+
+struct cdev {
+  void *owner;
+  const struct file_operations *ops;
+};
+
+static inline void cdev_init(struct cdev *cdev,
+                             const struct file_operations *fops) {
+  cdev->ops= fops;
+}
+static inline int cdev_add(struct cdev *cdev, dev_t dev, unsigned count) {
+  return 0;
+}
+static inline void cdev_del(struct cdev *cdev) { }
+
+#define GFP_KERNEL 0
+#define kmalloc(size, flags) malloc(size)
+#define kcalloc(n, size, flags) calloc((n), (size))
+
+/* no se incluye stdio.h: declara remove, que kmutex.c usa */
+int snprintf(char *str, size_t size, const char *format, ...);
+#define kfree(ptr) free(ptr)
+#define vmalloc(size) malloc(size)
+#define vmalloc_user(size) calloc(1, (size))
+#define vfree(ptr) free(ptr)
+
+static inline unsigned long roundup_pow_of_two(unsigned long n) {
+  unsigned long p= 1;
+  while (p<n)
+    p<<= 1;
+  return p;
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from,
+                                         unsigned long n) {
+  memcpy(to, from, n);
+  return 0;
+}
+static inline unsigned long copy_from_user(void *to, const void *from,
+                                           unsigned long n) {
+  memcpy(to, from, n);
+  return 0;
+}
+#define put_user(x, ptr) ({ *(ptr)= (x); 0; })
+#define u64_to_user_ptr(x) ((void *)(uintptr_t)(x))
+
+#endif
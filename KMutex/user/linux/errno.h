@@ -0,0 +1,4 @@
+/* Version para modo usuario: ver ../kshim.h.  La libc tambien incluye
+ * este archivo (desde <errno.h>), por eso se incluye ademas el original */
+#include_next <linux/errno.h>
+#include "../kshim.h"
@@ -0,0 +1,3 @@
+/* Version para modo usuario: las definiciones de _IO, _IOR, ... son las
+ * mismas del sistema */
+#include_next <linux/ioctl.h>
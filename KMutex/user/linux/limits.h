@@ -0,0 +1,2 @@
+/* Version para modo usuario: PIPE_BUF es el mismo del sistema */
+#include_next <linux/limits.h>
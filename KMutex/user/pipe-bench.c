@@ -0,0 +1,553 @@
+/* pipe-bench: mide el driver ../../Pipe compilado en modo usuario (ver
+ * kshim.h) con cada politica de entrega del mutex: cesion directa,
+ * KMUTEX_BARGE y KMUTEX_BOUNDED (ver "Politica de entrega" en kmutex.h).
+ *
+ * Se crean escritores y lectores que invocan vfs_write y vfs_read (ver
+ * kshim.h), tal como lo harian los procesos que escriben y leen
+ * /dev/pipe.  Para cada politica se reporta el rendimiento (bytes por
+ * segundo) y el tiempo promedio y maximo de una llamada, que incluye la
+ * espera del mutex y la espera en la condicion cuando el pipe esta vacio
+ * o lleno.
+ *
+ * Con -p pipes los escritores y lectores se reparten entre varios pipes
+ * (minors) independientes.
+ *
+ * Si cada pipe tiene un solo escritor y un solo lector, el escritor
+ * escribe bytes consecutivos y el lector revisa que lleguen en orden: el
+ * programa termina con status 1 si algun byte se pierde o se altera.
+ *
+ * Con -l y -H se fijan las marcas de agua del pipe (PIPE_SET_LOWAT y
+ * PIPE_SET_HIWAT): la columna ctxsw muestra cuantos cambios de contexto
+ * voluntarios hubo, es decir cuantas veces durmio un thread.
+ *
+ * Con -m cada escritor y cada lector proyecta el anillo del pipe con
+ * vfs_mmap y copia los datos directamente, usando el driver solo para
+ * dormir y despertar (ver pipe.h).  La columna ioctls muestra cuantas
+ * veces se invoco al driver.
+ *
+ * Con -P el pipe esta en modo paquete (PIPE_SET_PACKET): cada write es un
+ * registro y los lectores revisan que cada registro llegue completo.  Con
+ * -b n ademas cada lector lee hasta n registros por llamada con
+ * PIPE_READ_RECORDS.
+ *
+ * Al terminar cada medicion los escritores y lectores solo dejan de
+ * llamar al driver y cierran el pipe: los que esperan datos reciben el
+ * fin de archivo y los que esperan espacio EPIPE.
+ *
+ * Uso: ./pipe-bench [-d ms] [-w writers] [-r readers] [-c bytes]
+ *                   [-s pipe-size] [-p pipes] [-l lowat] [-H hiwat] [-m]
+ *                   [-P] [-b records]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <limits.h> /* PIPE_BUF */
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "kshim.h"
+#include "../../Pipe/pipe.h"
+
+/* Declarados en ../../Pipe/pipe-impl.c */
+extern struct file_operations pipe_fops;
+extern int pipe_major;
+int pipe_init(void);
+void pipe_exit(void);
+
+typedef struct {
+  pthread_t thread;
+  int writer;
+  int minor;
+  int chunk;
+  int opened;
+  int done;
+  int check;          /* escribir o revisar bytes consecutivos */
+  int ring;           /* usar el anillo proyectado */
+  int packet;         /* el pipe guarda registros de chunk bytes */
+  int batch;          /* registros por lectura (PIPE_READ_RECORDS) */
+  long long ioctls;   /* llamadas al driver con el anillo */
+  unsigned char next; /* el proximo byte consecutivo */
+  long long corrupt;  /* bytes que no llegaron en orden */
+  long long calls, bytes;
+  u64 total_ns, max_ns;
+} Worker;
+
+static int stop;
+static volatile sig_atomic_t sigpipes; /* SIGPIPE recibidos */
+
+/* Abre el pipe minor como lo haria open("/dev/pipe<minor>", ...) */
+static void open_pipe(struct file *filp, int minor) {
+  struct inode inode= { MKDEV(pipe_major, minor) };
+  filp->f_op= &pipe_fops;
+  pipe_fops.open(&inode, filp);
+}
+
+static void close_pipe(struct file *filp, int minor) {
+  struct inode inode= { MKDEV(pipe_major, minor) };
+  pipe_fops.release(&inode, filp);
+}
+
+/* Escribe n<=capacity bytes en el anillo como lo haria un proceso que lo
+ * proyecto: solo invoca al driver si tiene que esperar espacio o si el
+ * lector duerme.  Retorna n, o -EINTR. */
+static ssize_t ring_write(struct file *filp, struct pipe_ring *ring,
+                          const char *buf, unsigned n, long long *ioctls) {
+  char *data= (char *)ring+PIPE_RING_DATA;
+  unsigned capacity= ring->capacity, in= ring->in;
+  unsigned at= in & (capacity-1);
+  unsigned first= n < capacity-at ? n : capacity-at;
+  if (capacity-(in-__atomic_load_n(&ring->out, __ATOMIC_ACQUIRE))<n) {
+    long rc= pipe_fops.unlocked_ioctl(filp, PIPE_WAIT_WRITE, n);
+    (*ioctls)++;
+    if (rc<0)
+      return rc;
+  }
+  memcpy(data+at, buf, first);
+  memcpy(data, buf+first, n-first);
+  __atomic_store_n(&ring->in, in+n, __ATOMIC_RELEASE);
+  /* el lector publica waiting antes de revisar in (ver pipe_wait) */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if ((__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) & PIPE_READER) &&
+      in+n-__atomic_load_n(&ring->out, __ATOMIC_RELAXED)>=
+      __atomic_load_n(&ring->read_want, __ATOMIC_RELAXED)) {
+    pipe_fops.unlocked_ioctl(filp, PIPE_WAKE, PIPE_READER);
+    (*ioctls)++;
+  }
+  return n;
+}
+
+/* Lee hasta n bytes del anillo, esperando en el driver si esta vacio */
+static ssize_t ring_read(struct file *filp, struct pipe_ring *ring,
+                         char *buf, unsigned n, long long *ioctls) {
+  char *data= (char *)ring+PIPE_RING_DATA;
+  unsigned capacity= ring->capacity, out= ring->out;
+  unsigned at= out & (capacity-1);
+  unsigned size= __atomic_load_n(&ring->in, __ATOMIC_ACQUIRE)-out, first;
+  if (size==0) {
+    long rc= pipe_fops.unlocked_ioctl(filp, PIPE_WAIT_READ, 1);
+    (*ioctls)++;
+    if (rc<0)
+      return rc;
+    size= __atomic_load_n(&ring->in, __ATOMIC_ACQUIRE)-out;
+  }
+  if (n>size)
+    n= size;
+  first= n < capacity-at ? n : capacity-at;
+  memcpy(buf, data+at, first);
+  memcpy(buf+first, data, n-first);
+  __atomic_store_n(&ring->out, out+n, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if ((__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) & PIPE_WRITER) &&
+      capacity-(__atomic_load_n(&ring->in, __ATOMIC_RELAXED)-(out+n))>=
+      __atomic_load_n(&ring->write_want, __ATOMIC_RELAXED)) {
+    pipe_fops.unlocked_ioctl(filp, PIPE_WAKE, PIPE_WRITER);
+    (*ioctls)++;
+  }
+  return n;
+}
+
+static void interrupt(int sig) {
+  /* solo interrumpe sem_wait, como una senal interrumpe c_wait */
+}
+
+static void count_sigpipe(int sig) {
+  sigpipes++;
+}
+
+static void *work(void *ptr) {
+  Worker *w= ptr;
+  /* ambos lados del anillo escriben en el encabezado */
+  struct file filp= { w->ring ? FMODE_READ | FMODE_WRITE :
+                      w->writer ? FMODE_WRITE : FMODE_READ };
+  struct vm_area_struct vma;
+  struct pipe_ring *ring= NULL;
+  loff_t pos= 0;
+  char *buf= malloc(w->chunk*w->batch);
+  unsigned *lengths= calloc(w->batch, sizeof(unsigned));
+  open_pipe(&filp, w->minor);
+  if (w->ring) {
+    long capacity= pipe_fops.unlocked_ioctl(&filp, PIPE_GET_SIZE, 0);
+    ring= vfs_mmap(&filp, PIPE_RING_DATA+capacity, &vma);
+  }
+  __atomic_store_n(&w->opened, 1, __ATOMIC_RELEASE);
+  memset(buf, 'x', w->chunk);
+  while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+    u64 t0, t;
+    ssize_t rc;
+    if (w->check && w->writer) {
+      for (int i= 0; i<w->chunk; i++)
+        buf[i]= w->next++;
+    }
+    t0= ktime_get_ns();
+    if (ring)
+      rc= w->writer ? ring_write(&filp, ring, buf, w->chunk, &w->ioctls) :
+                      ring_read(&filp, ring, buf, w->chunk, &w->ioctls);
+    else if (w->batch>1 && !w->writer) {
+      struct pipe_records recs= { (uintptr_t)buf, w->chunk*w->batch, w->batch,
+                                  (uintptr_t)lengths };
+      rc= pipe_fops.unlocked_ioctl(&filp, PIPE_READ_RECORDS,
+                                   (unsigned long)&recs);
+      for (int i= 0; rc>=0 && i<recs.count; i++) {
+        if (lengths[i]!=w->chunk)
+          w->corrupt++;
+      }
+    }
+    else
+      rc= w->writer ? vfs_write(&filp, buf, w->chunk, &pos) :
+                      vfs_read(&filp, buf, w->chunk, &pos);
+    if (rc<=0)
+      break; /* fin de archivo, -EPIPE o -EINTR */
+    t= ktime_get_ns()-t0;
+    if (w->packet && w->batch==1 && !w->writer && rc!=w->chunk)
+      w->corrupt++; /* un registro partido o mezclado con otro */
+    if (w->check && !w->writer) {
+      for (int i= 0; i<rc; i++) {
+        if ((unsigned char)buf[i]!=w->next++)
+          w->corrupt++;
+      }
+    }
+    w->calls++;
+    w->bytes+= rc;
+    w->total_ns+= t;
+    if (t>w->max_ns)
+      w->max_ns= t;
+  }
+  free(buf);
+  free(lengths);
+  if (ring)
+    vfs_munmap(&vma);
+  close_pipe(&filp, w->minor);
+  __atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* Con O_NONBLOCK, read de un pipe vacio y write en un pipe lleno retornan
+ * -EAGAIN, y un write que no cabe completo escribe lo que cabe */
+static int check_nonblock(int minor, long capacity) {
+  struct file filp= { FMODE_READ | FMODE_WRITE, O_NONBLOCK };
+  loff_t pos= 0;
+  char *buf= calloc(capacity+PIPE_BUF, 1);
+  ssize_t empty, partial, full, drained;
+  open_pipe(&filp, minor);
+  empty= vfs_read(&filp, buf, 1, &pos);
+  partial= vfs_write(&filp, buf, capacity+PIPE_BUF, &pos);
+  full= vfs_write(&filp, buf, 1, &pos);
+  drained= vfs_read(&filp, buf, capacity+PIPE_BUF, &pos);
+  close_pipe(&filp, minor);
+  free(buf);
+  if (empty!=-EAGAIN || partial!=capacity || full!=-EAGAIN ||
+      drained!=capacity) {
+    fprintf(stderr, "O_NONBLOCK: read %zd, write %zd, write %zd, read %zd\n",
+            empty, partial, full, drained);
+    return -1;
+  }
+  return 0;
+}
+
+/* Un writev de varios segmentos escribe un solo bloque atomico y un readv
+ * lo reparte entre sus segmentos en orden */
+static int check_vectored(int minor) {
+  struct file filp= { FMODE_READ | FMODE_WRITE, O_NONBLOCK };
+  char header[3]= "hdr", payload[5]= "01234", out[3], in[5];
+  struct iovec wv[2]= { { header, sizeof(header) },
+                        { payload, sizeof(payload) } };
+  struct iovec rv[2]= { { out, sizeof(out) }, { in, sizeof(in) } };
+  loff_t pos= 0;
+  ssize_t written, read;
+  open_pipe(&filp, minor);
+  written= vfs_writev(&filp, wv, 2, &pos);
+  read= vfs_readv(&filp, rv, 2, &pos);
+  close_pipe(&filp, minor);
+  if (written!=8 || read!=8 || memcmp(out, "hdr", 3)!=0 ||
+      memcmp(in, "01234", 5)!=0) {
+    fprintf(stderr, "writev wrote %zd bytes, readv read %zd\n",
+            written, read);
+    return -1;
+  }
+  return 0;
+}
+
+/* En modo paquete cada write es un registro: read entrega uno solo y
+ * descarta lo que no cabe (pero un read de 0 bytes no descarta nada), y
+ * PIPE_READ_RECORDS entrega todos los registros completos que quepan */
+static int check_packet(struct file *filp) {
+  char buf[16];
+  unsigned lengths[4];
+  struct pipe_records recs= { (uintptr_t)buf, sizeof(buf), 4,
+                              (uintptr_t)lengths };
+  loff_t pos= 0;
+  ssize_t none, one, cut, batch, empty;
+  filp->f_flags|= O_NONBLOCK;
+  if (pipe_fops.unlocked_ioctl(filp, PIPE_SET_PACKET, 1)!=1) {
+    fprintf(stderr, "PIPE_SET_PACKET failed\n");
+    return -1;
+  }
+  vfs_write(filp, "abc", 3, &pos);
+  vfs_write(filp, "defgh", 5, &pos);
+  vfs_write(filp, "ij", 2, &pos);
+  vfs_write(filp, "klm", 3, &pos);
+  none= vfs_read(filp, buf, 0, &pos);
+  one= vfs_read(filp, buf, sizeof(buf), &pos);
+  cut= vfs_read(filp, buf+one, 2, &pos);
+  batch= pipe_fops.unlocked_ioctl(filp, PIPE_READ_RECORDS,
+                                  (unsigned long)&recs);
+  empty= vfs_read(filp, buf, sizeof(buf), &pos);
+  filp->f_flags&= ~O_NONBLOCK;
+  if (none!=0 || one!=3 || cut!=2 || batch!=5 || recs.count!=2 || lengths[0]!=2 ||
+      lengths[1]!=3 || memcmp(buf, "ijklm", 5)!=0 || empty!=-EAGAIN ||
+      pipe_fops.unlocked_ioctl(filp, PIPE_SET_PACKET, 0)!=0) {
+    fprintf(stderr, "packet mode: read %zd, %zd, %zd, PIPE_READ_RECORDS "
+            "%zd (%u records), read %zd\n", none, one, cut, batch,
+            recs.count, empty);
+    return -1;
+  }
+  return 0;
+}
+
+/* Cuando el ultimo escritor cierra el pipe, un lector recibe lo que
+ * quedaba y despues el fin de archivo, y cuando el ultimo lector lo
+ * cierra, un escritor recibe EPIPE y SIGPIPE.  Ninguno de los dos espera
+ * aunque no tenga O_NONBLOCK. */
+static int check_eof(int minor) {
+  struct file reader= { FMODE_READ };
+  struct file writer= { FMODE_WRITE };
+  loff_t pos= 0;
+  char buf[4];
+  ssize_t data, eof, broken;
+  __poll_t hup, err;
+  int signals= sigpipes;
+  open_pipe(&reader, minor);
+  open_pipe(&writer, minor);
+  vfs_write(&writer, "eof", 3, &pos);
+  close_pipe(&writer, minor);
+  data= vfs_read(&reader, buf, sizeof(buf), &pos);
+  eof= vfs_read(&reader, buf, sizeof(buf), &pos);
+  hup= pipe_fops.poll(&reader, NULL);
+  open_pipe(&writer, minor);
+  close_pipe(&reader, minor);
+  broken= vfs_write(&writer, "x", 1, &pos);
+  err= pipe_fops.poll(&writer, NULL);
+  close_pipe(&writer, minor);
+  if (data!=3 || eof!=0 || hup!=EPOLLHUP || broken!=-EPIPE ||
+      err!=(EPOLLOUT | EPOLLWRNORM | EPOLLERR) || sigpipes!=signals+1) {
+    fprintf(stderr, "closing the pipe: read %zd, %zd, poll %#x, "
+            "write %zd, poll %#x, %d SIGPIPE\n", data, eof, hup, broken, err,
+            sigpipes-signals);
+    return -1;
+  }
+  return 0;
+}
+
+/* Mientras el pipe este proyectado su capacidad no puede cambiar */
+static int check_mmap(struct file *filp, long capacity) {
+  struct vm_area_struct vma;
+  struct pipe_ring *ring= vfs_mmap(filp, PIPE_RING_DATA+capacity, &vma);
+  long busy;
+  if (ring==NULL || ring->capacity!=capacity) {
+    fprintf(stderr, "mmap of %ld bytes failed\n", PIPE_RING_DATA+capacity);
+    return -1;
+  }
+  busy= pipe_fops.unlocked_ioctl(filp, PIPE_SET_SIZE, capacity);
+  vfs_munmap(&vma);
+  if (busy!=-EBUSY) {
+    fprintf(stderr, "PIPE_SET_SIZE on a mapped pipe returned %ld\n", busy);
+    return -1;
+  }
+  return 0;
+}
+
+/* Las opciones de la linea de comandos */
+typedef struct {
+  int ms, writers, readers, chunk, pipe_size, npipes, lowat, hiwat, ring;
+  int packet, batch;
+} Options;
+
+static int run(int policy, const char *name, Options *o) {
+  int ms= o->ms, writers= o->writers, readers= o->readers;
+  int chunk= o->chunk, pipe_size= o->pipe_size, npipes= o->npipes;
+  int n= writers+readers;
+  Worker *workers= calloc(n, sizeof(Worker));
+  long long bytes= 0, corrupt= 0, calls[2]= { 0, 0 }, ioctls= 0;
+  u64 total[2]= { 0, 0 }, max[2]= { 0, 0 };
+  struct rusage before, after;
+
+  kshim_set_param("lock_policy", policy);
+  kshim_set_param("nr_pipes", npipes);
+  if (pipe_init()!=0) {
+    fprintf(stderr, "pipe_init failed\n");
+    return -1;
+  }
+  for (int minor= 0; minor<npipes; minor++) {
+    struct file filp= { FMODE_READ | FMODE_WRITE };
+    open_pipe(&filp, minor);
+    /* la capacidad se fija con ioctl, como lo haria un programa */
+    if (pipe_fops.unlocked_ioctl(&filp, PIPE_SET_SIZE, pipe_size)<0 ||
+        pipe_fops.unlocked_ioctl(&filp, PIPE_GET_SIZE, 0)<pipe_size) {
+      fprintf(stderr, "PIPE_SET_SIZE %d failed\n", pipe_size);
+      return -1;
+    }
+    /* un pipe vacio se puede escribir pero no leer */
+    if (pipe_fops.poll(&filp, NULL)!=(EPOLLOUT | EPOLLWRNORM)) {
+      fprintf(stderr, "poll on an empty pipe returned %#x\n",
+              pipe_fops.poll(&filp, NULL));
+      return -1;
+    }
+    if (check_vectored(minor)<0 ||
+        check_nonblock(minor,
+                       pipe_fops.unlocked_ioctl(&filp, PIPE_GET_SIZE, 0))<0 ||
+        check_mmap(&filp, pipe_fops.unlocked_ioctl(&filp, PIPE_GET_SIZE, 0))<0 ||
+        check_packet(&filp)<0)
+      return -1;
+    if (o->packet && pipe_fops.unlocked_ioctl(&filp, PIPE_SET_PACKET, 1)!=1) {
+      fprintf(stderr, "PIPE_SET_PACKET failed\n");
+      return -1;
+    }
+    if (pipe_fops.unlocked_ioctl(&filp, PIPE_SET_LOWAT, o->lowat)!=o->lowat ||
+        pipe_fops.unlocked_ioctl(&filp, PIPE_SET_HIWAT, o->hiwat)!=o->hiwat) {
+      fprintf(stderr, "PIPE_SET_LOWAT/PIPE_SET_HIWAT failed\n");
+      return -1;
+    }
+    close_pipe(&filp, minor);
+    /* con filp abierto para leer y escribir el pipe nunca se cierra */
+    if (check_eof(minor)<0)
+      return -1;
+  }
+  __atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+  getrusage(RUSAGE_SELF, &before);
+  for (int i= 0; i<n; i++) {
+    workers[i].writer= i<writers;
+    workers[i].minor= (i<writers ? i : i-writers) % npipes;
+    workers[i].chunk= chunk;
+    workers[i].check= writers==npipes && readers==npipes;
+    workers[i].ring= o->ring;
+    workers[i].packet= o->packet;
+    workers[i].batch= o->batch;
+    pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+  }
+  /* un lector que abre el pipe despues de que lo cerraron todos los
+   * escritores esperaria al proximo */
+  for (int i= 0; i<n; i++) {
+    while (!__atomic_load_n(&workers[i].opened, __ATOMIC_ACQUIRE))
+      usleep(100);
+  }
+  usleep(ms*1000);
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  for (int i= 0; i<n; i++) {
+    /* Con -m el archivo esta abierto para leer y escribir, de modo que el
+     * otro lado nunca cierra el pipe: un thread bloqueado en c_wait solo
+     * termina si se le envia una senal, y una senal que llega fuera de
+     * c_wait se pierde. */
+    while (o->ring && !__atomic_load_n(&workers[i].done, __ATOMIC_ACQUIRE)) {
+      pthread_kill(workers[i].thread, SIGUSR1);
+      usleep(1000);
+    }
+    pthread_join(workers[i].thread, NULL);
+  }
+  getrusage(RUSAGE_SELF, &after);
+  pipe_exit();
+
+  for (int i= 0; i<n; i++) {
+    Worker *w= &workers[i];
+    if (!w->writer)
+      bytes+= w->bytes;
+    corrupt+= w->corrupt;
+    ioctls+= w->ioctls;
+    calls[w->writer]+= w->calls;
+    total[w->writer]+= w->total_ns;
+    if (w->max_ns>max[w->writer])
+      max[w->writer]= w->max_ns;
+  }
+  printf("%-8s %12.0f %10.0f %10llu %10.0f %10llu %8ld", name,
+         bytes*1000.0/ms,
+         calls[0] ? (double)total[0]/calls[0] : 0.0, max[0],
+         calls[1] ? (double)total[1]/calls[1] : 0.0, max[1],
+         after.ru_nvcsw-before.ru_nvcsw);
+  if (o->ring)
+    printf(" %8lld", ioctls);
+  printf("\n");
+  free(workers);
+  if (corrupt>0) {
+    fprintf(stderr, "%lld bytes lost or out of order\n", corrupt);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  Options o= { 1000, 4, 4, 8, PIPE_MIN_SIZE, 1, 1, PIPE_MAX_SIZE, 0, 0, 1 };
+  int opt;
+  struct sigaction sa;
+
+  while ((opt= getopt(argc, argv, "d:w:r:c:s:p:l:H:mPb:"))!=-1) {
+    switch (opt) {
+    case 'd': o.ms= atoi(optarg); break;
+    case 'w': o.writers= atoi(optarg); break;
+    case 'r': o.readers= atoi(optarg); break;
+    case 'c': o.chunk= atoi(optarg); break;
+    case 's': o.pipe_size= atoi(optarg); break;
+    case 'p': o.npipes= atoi(optarg); break;
+    case 'l': o.lowat= atoi(optarg); break;
+    case 'H': o.hiwat= atoi(optarg); break;
+    case 'm': o.ring= 1; break;
+    case 'P': o.packet= 1; break;
+    case 'b': o.batch= atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-d ms] [-w writers] [-r readers] "
+              "[-c bytes] [-s pipe-size] [-p pipes] [-l lowat] "
+              "[-H hiwat] [-m] [-P] [-b records]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (o.chunk<1 || o.chunk>PIPE_MAX_SIZE || o.pipe_size<1 ||
+      o.pipe_size>PIPE_MAX_SIZE || o.npipes<1 || o.npipes>256 ||
+      o.writers<o.npipes || o.readers<o.npipes || o.lowat<1 ||
+      o.lowat>PIPE_MAX_SIZE || o.hiwat<0 || o.hiwat>PIPE_MAX_SIZE) {
+    fprintf(stderr, "%s: need 1 <= bytes, pipe-size, lowat <= %d, "
+            "0 <= hiwat <= %d, 1 <= pipes <= 256 and at least one writer "
+            "and one reader per pipe\n", argv[0], PIPE_MAX_SIZE,
+            PIPE_MAX_SIZE);
+    return 2;
+  }
+  if (o.ring && (o.writers!=o.npipes || o.readers!=o.npipes ||
+                 o.chunk>o.pipe_size)) {
+    fprintf(stderr, "%s: -m needs one writer and one reader per pipe and "
+            "bytes <= pipe-size\n", argv[0]);
+    return 2;
+  }
+  if (o.batch<1 || (o.batch>1 && !o.packet) || (o.packet && o.ring) ||
+      (o.packet && o.chunk+PIPE_RECORD_HDR>o.pipe_size)) {
+    fprintf(stderr, "%s: -b needs -P, -P excludes -m, and with -P "
+            "bytes+%d <= pipe-size\n", argv[0], PIPE_RECORD_HDR);
+    return 2;
+  }
+
+  /* sin SA_RESTART para que la senal interrumpa c_wait */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler= interrupt;
+  sigaction(SIGUSR1, &sa, NULL);
+  /* un escritor que recibe EPIPE tambien recibe SIGPIPE (ver check_eof) */
+  sa.sa_handler= count_sigpipe;
+  sigaction(SIGPIPE, &sa, NULL);
+  kshim_quiet= 1; /* el driver escribe mensajes en cada llamada */
+
+  printf("%d writers, %d readers, %d bytes per call, %d pipes of %d bytes\n",
+         o.writers, o.readers, o.chunk, o.npipes, o.pipe_size);
+  if (o.lowat!=1 || o.hiwat!=PIPE_MAX_SIZE)
+    printf("low watermark %d bytes, high watermark %d bytes\n",
+           o.lowat, o.hiwat);
+  if (o.ring)
+    printf("writers and readers use the mapped ring\n");
+  if (o.packet)
+    printf("packet mode, up to %d records per read\n", o.batch);
+  printf("policy          bytes/s    read-avg   read-max  write-avg  "
+         "write-max    ctxsw%s\n", o.ring ? "   ioctls" : "");
+  if (run(0, "handoff", &o)<0 || run(1, "barge", &o)<0 ||
+      run(2, "bounded", &o)<0)
+    return 1;
+  return 0;
+}
@@ -0,0 +1,2 @@
+/* Version para modo usuario: ver ../../../kshim.h */
+#include "../../../kshim.h"
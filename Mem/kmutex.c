@@ -0,0 +1 @@
+../KMutex/kmutex.c
\ No newline at end of file
@@ -0,0 +1 @@
+../KMutex/kmutex.h
\ No newline at end of file
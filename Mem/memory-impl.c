@@ -0,0 +1,253 @@
+/* Driver memory.c: una memoria residente en el nucleo.
+ *
+ * Un write suministra datos que se almacenan en una memoria residente
+ * en el nucleo.
+ *
+ * Cada write sobreescribe los datos del write previo.
+ *
+ * La operacion read nunca se bloquea, ni siquiera mientras otro proceso
+ * escribe.
+ * Cada read entrega los datos sumnistrados en el ultimo write y
+ * borra los datos.  Si se lee cuando no hay datos, read entrega
+ * 0 bytes (lo que usualmente se interpreta como fin de archivo).
+ */
+
+/* Necessary includes for device drivers */
+#include <linux/init.h>
+/* #include <linux/config.h> */
+#include <linux/module.h>
+#include <linux/kernel.h> /* printk(), pr_debug() */
+#include <linux/slab.h> /* kmalloc() */
+#include <linux/fs.h> /* everything... */
+#include <linux/errno.h> /* error codes */
+#include <linux/types.h> /* size_t */
+#include <linux/proc_fs.h>
+#include <linux/fcntl.h> /* O_ACCMODE */
+#include <linux/uio.h> /* iov_iter */
+#include <linux/atomic.h> /* xchg, cmpxchg */
+
+#include "kmutex.h"
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/* Declaration of memory.c functions */
+static int memory_open(struct inode *inode, struct file *filp);
+static int memory_release(struct inode *inode, struct file *filp);
+static ssize_t memory_read(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t memory_write(struct kiocb *iocb, struct iov_iter *from);
+void memory_exit(void);
+int memory_init(void);
+
+/* Structure that declares the usual file */
+/* access functions.  Con read_iter y write_iter un readv o writev de
+ * varios segmentos es una sola lectura o escritura. */
+static struct file_operations memory_fops = {
+  read_iter: memory_read,
+  write_iter: memory_write,
+  open: memory_open,
+  release: memory_release
+};
+
+/* Declaration of the init and exit functions */
+module_init(memory_init);
+module_exit(memory_exit);
+
+/* Global variables of the driver */
+/* Major number */
+static int memory_major = 61;
+/* Buffer to store data */
+#define MAX_SIZE 8192
+static char *memory_buffer;
+static ssize_t curr_size;
+/* Un escritor copia los datos del usuario en staging_buffer antes de
+ * copiarlos a memory_buffer.  Solo se usa teniendo lock */
+static char *staging_buffer;
+/* Protege memory_buffer y curr_size.  Los lectores solo necesitan una
+ * copia consistente de ellos, por lo que no piden el candado: la copia se
+ * repite si un escritor los modifico mientras tanto. */
+static KSeqLock lock;
+static struct semaphore write_mutex;
+static KStatsDir stats_dir;
+
+int memory_init(void) {
+  int result;
+
+  /* Registering device */
+  result = register_chrdev(memory_major, "memory", &memory_fops);
+  if (result < 0) {
+    printk(
+      "<1>memory: cannot obtain major number %d\n", memory_major);
+    return result;
+  }
+
+  sq_init(&lock);
+  sema_init(&write_mutex, 1);
+  m_stats_init(&stats_dir, "memory");
+  m_stats_register(&stats_dir, "lock", &lock.mutex);
+
+  /* Allocating memory for the buffer */
+  memory_buffer = kmalloc(MAX_SIZE, GFP_KERNEL); 
+  staging_buffer = kmalloc(MAX_SIZE, GFP_KERNEL);
+  if (!memory_buffer || !staging_buffer) { 
+    result = -ENOMEM;
+    goto fail; 
+  } 
+  memset(memory_buffer, 0, MAX_SIZE);
+  curr_size= 0;
+
+  printk("<1>Inserting memory module\n"); 
+  return 0;
+
+  fail: 
+    memory_exit(); 
+    return result;
+}
+
+void memory_exit(void) {
+  /* Freeing the major number */
+  unregister_chrdev(memory_major, "memory");
+  m_stats_exit(&stats_dir);
+
+  /* Freeing buffer memory */
+  if (memory_buffer) {
+    kfree(memory_buffer);
+  }
+  if (staging_buffer) {
+    kfree(staging_buffer);
+  }
+
+  printk("<1>Removing memory module\n");
+
+}
+
+static int memory_open(struct inode *inode, struct file *filp) {
+  char *mode=   filp->f_mode & FMODE_WRITE ? "write" :
+                filp->f_mode & FMODE_READ ? "read" :
+                "unknown";
+  if (filp->f_mode & FMODE_WRITE) {
+    int rc= down_interruptible(&write_mutex);
+    if (rc) {
+      printk("<1> down interrupted, rc=%d\n", rc);
+      return rc;
+    }
+    sq_write_lock(&lock);
+    sq_write_begin(&lock);
+    curr_size= 0;
+    sq_write_end(&lock);
+    sq_write_unlock(&lock);
+  }
+  printk("<1>open for %s\n", mode);
+  /* Success */
+  return 0;
+}
+
+static int memory_release(struct inode *inode, struct file *filp) {
+ 
+  if (filp->f_mode & FMODE_WRITE) {
+    up(&write_mutex);
+  }
+  kfree(filp->private_data);
+  printk("<1>close\n");
+  /* Success */
+  return 0;
+}
+
+/* Un read copia los datos a un buffer propio antes de transferirlos.
+ * Para no pedir memoria en cada read, cada archivo abierto guarda en
+ * private_data un buffer de MAX_SIZE bytes que se reusa.  Si dos reads
+ * del mismo archivo coinciden, el segundo pide un buffer aparte y lo
+ * libera al terminar. */
+static char *snapshot_get(struct file *filp) {
+  char *snapshot= xchg(&filp->private_data, NULL);
+  return snapshot!=NULL ? snapshot : kmalloc(MAX_SIZE, GFP_KERNEL);
+}
+
+static void snapshot_put(struct file *filp, char *snapshot) {
+  if (cmpxchg(&filp->private_data, NULL, snapshot)!=NULL)
+    kfree(snapshot);
+}
+
+static ssize_t memory_read(struct kiocb *iocb, struct iov_iter *to) { 
+  struct file *filp= iocb->ki_filp;
+  loff_t *f_pos= &iocb->ki_pos;
+  size_t count= iov_iter_count(to);
+  unsigned seq;
+  ssize_t size;
+  size_t n, copied;
+  char *snapshot;
+
+  if (count > MAX_SIZE) {
+    count= MAX_SIZE;
+  }
+  snapshot= snapshot_get(filp);
+  if (snapshot==NULL)
+    return -ENOMEM;
+
+  /* copy_to_user puede dormir, por lo que primero se copia a snapshot.
+   * Un escritor puede cambiar curr_size en cualquier momento, asi que se
+   * lee una sola vez y se acota a MAX_SIZE antes de calcular n: aunque
+   * la copia se vaya a repetir, nunca se lee fuera de memory_buffer. */
+  do {
+    seq= sq_read_begin(&lock);
+    size= READ_ONCE(curr_size);
+    if (size > MAX_SIZE) {
+      size= MAX_SIZE;
+    }
+    n= count;
+    if (*f_pos >= size) {
+      n= 0;
+    }
+    else if (n > size-*f_pos) {
+      n= size-*f_pos;
+    }
+    memcpy(snapshot, memory_buffer+*f_pos, n);
+  } while (sq_read_retry(&lock, seq));
+
+  pr_debug("read %d bytes at %d\n", (int)n, (int)*f_pos);
+
+  /* Transfering data to user space.  Si una direccion no es valida se
+   * entrega lo que se alcanzo a copiar. */
+  copied= copy_to_iter(snapshot, n, to);
+  snapshot_put(filp, snapshot);
+  if (copied==0 && n>0)
+    return -EFAULT;
+
+  *f_pos+= copied;
+  return copied;
+}
+
+static ssize_t memory_write(struct kiocb *iocb, struct iov_iter *from) {
+  loff_t *f_pos= &iocb->ki_pos;
+  size_t count= iov_iter_count(from);
+  ssize_t rc;
+  loff_t last;
+
+  sq_write_lock(&lock);
+
+  last= *f_pos + count;
+  if (last>MAX_SIZE) {
+    count -= last-MAX_SIZE;
+  }
+  pr_debug("write %d bytes at %d\n", (int)count, (int)*f_pos);
+
+  /* Transfering data from user space.  copy_from_iter puede dormir, y los
+   * lectores esperan activamente entre sq_write_begin y sq_write_end.  Los
+   * segmentos de un writev quedan seguidos en staging_buffer y se publican
+   * juntos. */
+  if (copy_from_iter(staging_buffer, count, from)!=count) {
+    /* una direccion de origen no es valida */
+    rc= -EFAULT;
+    goto epilog;
+  }
+
+  sq_write_begin(&lock);
+  memcpy(memory_buffer+*f_pos, staging_buffer, count);
+  curr_size= *f_pos + count;
+  sq_write_end(&lock);
+  *f_pos += count;
+  rc= count;
+
+epilog:
+  sq_write_unlock(&lock);
+  return rc;
+}
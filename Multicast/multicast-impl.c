@@ -2,13 +2,14 @@
 #include <linux/init.h>
 /* #include <linux/config.h> */
 #include <linux/module.h>
-#include <linux/kernel.h> /* printk() */
+#include <linux/kernel.h> /* printk(), pr_debug() */
 #include <linux/slab.h> /* kmalloc() */
 #include <linux/fs.h> /* everything... */
 #include <linux/errno.h> /* error codes */
 #include <linux/types.h> /* size_t */
 #include <linux/proc_fs.h>
-#include <linux/uaccess.h> /* copy_from/to_user */
+#include <linux/uio.h> /* iov_iter */
+#include <linux/atomic.h> /* xchg, cmpxchg */
 
 #include "kmutex.h"
 
@@ -17,16 +18,17 @@ MODULE_LICENSE("Dual BSD/GPL");
 /* Declaration of multicast.c functions */
 static int multicast_open(struct inode *inode, struct file *filp);
 static int multicast_release(struct inode *inode, struct file *filp);
-static ssize_t multicast_read(struct file *filp, char *buf, size_t count, loff_t *f_pos);
-static ssize_t multicast_write(struct file *filp, const char *buf, size_t count, loff_t *f_pos);
+static ssize_t multicast_read(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t multicast_write(struct kiocb *iocb, struct iov_iter *from);
 void multicast_exit(void);
 int multicast_init(void);
 
 /* Structure that declares the usual file */
-/* access functions */
+/* access functions.  Con read_iter y write_iter los segmentos de un
+ * writev forman un solo mensaje. */
 struct file_operations multicast_fops = {
-  read: multicast_read,
-  write: multicast_write,
+  read_iter: multicast_read,
+  write_iter: multicast_write,
   open: multicast_open,
   release: multicast_release
 };
@@ -45,10 +47,17 @@ int multicast_major = 60;
 static char *multicast_buffer= NULL;
 static size_t curr_size;
 static size_t curr_pos;
-
-/* El mutex y la condicion para multicast */
-static KMutex mutex;
-static KCondition cond;
+/* Un escritor copia los datos del usuario en spare_buffer y luego lo
+ * intercambia con multicast_buffer.  Solo se modifica teniendo seqlock */
+static char *spare_buffer= NULL;
+
+/* Los lectores solo necesitan una copia consistente de multicast_buffer,
+ * curr_size y curr_pos, por lo que no piden ningun candado: los leen
+ * protegidos por seqlock y nunca bloquean a un escritor.  Los lectores
+ * esperan el proximo write con el contador de eventos written. */
+static KSeqLock seqlock;
+static KEventCount written;
+static KStatsDir stats_dir;
 
 int multicast_init(void) {
   int rc;
@@ -63,15 +72,18 @@ int multicast_init(void) {
 
   /* Allocating multicast_buffer */
   multicast_buffer = kmalloc(MAX_SIZE, GFP_KERNEL); 
-  if (!multicast_buffer) { 
+  spare_buffer = kmalloc(MAX_SIZE, GFP_KERNEL);
+  if (!multicast_buffer || !spare_buffer) { 
     rc = -ENOMEM;
     goto fail; 
   } 
   memset(multicast_buffer, 0, MAX_SIZE);
   curr_size= 0;
   curr_pos= 0;
-  m_init(&mutex);
-  c_init(&cond);
+  sq_init(&seqlock);
+  ec_init(&written);
+  m_stats_init(&stats_dir, "multicast");
+  m_stats_register(&stats_dir, "mutex", &seqlock.mutex);
 
   printk("<1>Inserting multicast module\n"); 
   return 0;
@@ -84,11 +96,15 @@ int multicast_init(void) {
 void multicast_exit(void) {
   /* Freeing the major number */
   unregister_chrdev(multicast_major, "multicast");
+  m_stats_exit(&stats_dir);
 
   /* Freeing buffer multicast */
   if (multicast_buffer) {
     kfree(multicast_buffer);
   }
+  if (spare_buffer) {
+    kfree(spare_buffer);
+  }
 
   printk("<1>Removing multicast module\n");
 }
@@ -99,64 +115,107 @@ static int multicast_open(struct inode *inode, struct file *filp) {
 }
 
 static int multicast_release(struct inode *inode, struct file *filp) {
+  kfree(filp->private_data);
   printk("<1>close succeeded (%p)\n", filp);
   return 0;
 }
 
-static ssize_t multicast_read(struct file *filp, char *buf, 
-                    size_t count, loff_t *f_pos) { 
+/* Un read copia los datos a un buffer propio antes de transferirlos.
+ * Para no pedir memoria en cada read, cada archivo abierto guarda en
+ * private_data un buffer de MAX_SIZE bytes que se reusa.  Si dos reads
+ * del mismo archivo coinciden, el segundo pide un buffer aparte y lo
+ * libera al terminar. */
+static char *snapshot_get(struct file *filp) {
+  char *snapshot= xchg(&filp->private_data, NULL);
+  return snapshot!=NULL ? snapshot : kmalloc(MAX_SIZE, GFP_KERNEL);
+}
+
+static void snapshot_put(struct file *filp, char *snapshot) {
+  if (cmpxchg(&filp->private_data, NULL, snapshot)!=NULL)
+    kfree(snapshot);
+}
+
+static ssize_t multicast_read(struct kiocb *iocb, struct iov_iter *to) { 
+  struct file *filp= iocb->ki_filp;
+  size_t count= iov_iter_count(to);
   ssize_t rc= 0;
-  m_lock(&mutex); 
-  if (c_wait(&cond, &mutex)) {
+  unsigned long key;
+  unsigned seq;
+  size_t size, pos, n;
+  char *snapshot= snapshot_get(filp);
+  if (snapshot==NULL)
+    return -ENOMEM;
+
+  /* espera el proximo write */
+  key= ec_read(&written);
+  if (ec_await(&written, key)) {
     printk("<1>read interrupted while waiting for data\n");
     rc= -EINTR;
     goto epilog;
   }
 
-  if (count > curr_size) {
-    count= curr_size;
-  }
-
-  printk("<1>read %d bytes at %d (%p)\n", (int)count, (int)*f_pos, filp);
+  /* Si otro write ocurre mientras se copia, la copia se repite y el lector
+   * recibe el mensaje mas reciente.  curr_size se lee una sola vez y se
+   * acota a MAX_SIZE: aunque la copia se vaya a repetir, nunca se lee
+   * fuera del buffer */
+  do {
+    seq= sq_read_begin(&seqlock);
+    size= READ_ONCE(curr_size);
+    if (size > MAX_SIZE)
+      size= MAX_SIZE;
+    pos= curr_pos;
+    n= count > size ? size : count;
+    memcpy(snapshot, READ_ONCE(multicast_buffer), n);
+  } while (sq_read_retry(&seqlock, seq));
+
+  pr_debug("read %d bytes at %d (%p)\n", (int)n, (int)(pos-size), filp);
 
   /* Transfering data to user space */ 
-  if (copy_to_user(buf, multicast_buffer, count)!=0) {
+  if (copy_to_iter(snapshot, n, to)!=n) {
     rc= -EFAULT;
     goto epilog;
   }
-  *f_pos= curr_pos - (curr_size-count);
-  rc= count;
+  iocb->ki_pos= pos - (size-n);
+  rc= n;
 
 epilog:
-  m_unlock(&mutex);
-
+  snapshot_put(filp, snapshot);
   return rc;
 }
 
-static ssize_t multicast_write( struct file *filp, const char *buf,
-                      size_t count, loff_t *f_pos) {
+static ssize_t multicast_write(struct kiocb *iocb, struct iov_iter *from) {
+  struct file *filp= iocb->ki_filp;
+  size_t count= iov_iter_count(from);
   ssize_t rc;
-  m_lock(&mutex);
+  char *old;
+  sq_write_lock(&seqlock);
  
   if (count>MAX_SIZE) {
     count = MAX_SIZE;
   }
-  printk("<1>write %lu bytes at %lu (%p)\n", count, curr_pos, filp);
+  pr_debug("write %lu bytes at %lu (%p)\n", count, curr_pos, filp);
 
-  /* Transfering data from user space */ 
-  if (copy_from_user(multicast_buffer, buf, count)!=0) {
+  /* Transfering data from user space.  copy_from_iter puede dormir, por
+   * lo que se copia a spare_buffer, que ningun lector mira, antes de
+   * sq_write_begin */
+  if (copy_from_iter(spare_buffer, count, from)!=count) {
     rc= -EFAULT;
     goto epilog;
   }
+  sq_write_begin(&seqlock);
+  old= multicast_buffer;
+  multicast_buffer= spare_buffer;
+  spare_buffer= old;
   curr_size = count;
   curr_pos += count;
-  *f_pos= curr_pos;
-  c_broadcast(&cond);
+  sq_write_end(&seqlock);
+  iocb->ki_pos= curr_pos;
   rc= count;
 
 epilog:
-  m_unlock(&mutex);
+  sq_write_unlock(&seqlock);
+  if (rc>=0)
+    ec_advance(&written);
 
   return rc;
 }
-
@@ -0,0 +1,139 @@
+/* sigstress: mide cuanto demora el driver en deshacerse de muchos lectores
+ * de /dev/multicast que son interrumpidos al mismo tiempo.
+ *
+ * Se crean n procesos que quedan bloqueados en read (es decir en ec_await,
+ * esperando el proximo write) y luego se les envia SIGINT a todos a la vez.
+ * Cada lector interrumpido debe sacar su link de la cola del contador de
+ * eventos (con el mismo cancel que usa c_wait) antes de retornar de read
+ * con EINTR.  Si sacar el link fuese O(n), el tiempo total creceria
+ * cuadraticamente con n; con la cola doblemente enlazada el tiempo por
+ * lector debe mantenerse constante.
+ * La misma prueba para procesos en c_wait (KCondition) es parte de
+ * KMutex/user/kmutex-bench (opcion -s).
+ *
+ * Se mide desde el kill hasta que el ultimo lector retorna de read (cada
+ * lector informa ese instante por un pipe).  Incluye la entrega de la senal
+ * y la planificacion de los lectores, pero no la muerte de los procesos:
+ * se les envia SIGKILL y se esperan fuera de la medicion.
+ *
+ * Uso: ./sigstress [n ...]    (por omision: 1000 2000 4000 8000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define DEVICE "/dev/multicast"
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+static void interrupted(int sig) {
+}
+
+static void reader(int ready_fd, int done_fd) {
+  char buf[1];
+  double t;
+  struct sigaction sa= { .sa_handler= interrupted }; /* sin SA_RESTART */
+  int fd= open(DEVICE, O_RDONLY);
+  if (fd<0) {
+    perror(DEVICE);
+    exit(1);
+  }
+  sigaction(SIGINT, &sa, NULL);
+  /* avisa al padre que esta por bloquearse */
+  if (write(ready_fd, "r", 1)!=1)
+    exit(1);
+  while (read(fd, buf, sizeof(buf))>=0 || errno!=EINTR)
+    ;
+  /* informa cuando salio del driver; sizeof(t)<PIPE_BUF es atomico */
+  t= now_ms();
+  if (write(done_fd, &t, sizeof(t))!=sizeof(t))
+    exit(1);
+  for (;;)
+    pause();
+}
+
+static int stress(int n) {
+  int ready[2], done[2];
+  pid_t pgid= 0;
+  double t0, t, t1;
+  char c;
+
+  if (pipe(ready)<0 || pipe(done)<0) {
+    perror("pipe");
+    return -1;
+  }
+
+  for (int i= 0; i<n; i++) {
+    pid_t pid= fork();
+    if (pid<0) {
+      perror("fork");
+      n= i;
+      break;
+    }
+    if (pid==0) {
+      close(ready[0]);
+      close(done[0]);
+      setpgid(0, pgid);
+      reader(ready[1], done[1]);
+    }
+    /* todos los lectores en un mismo grupo para interrumpirlos de una vez */
+    if (pgid==0)
+      pgid= pid;
+    setpgid(pid, pgid);
+  }
+  close(ready[1]);
+  close(done[1]);
+
+  for (int i= 0; i<n; i++) {
+    if (read(ready[0], &c, 1)!=1)
+      break;
+  }
+  close(ready[0]);
+  usleep(500*1000); /* da tiempo a que el ultimo llegue a ec_await */
+
+  t0= now_ms();
+  kill(-pgid, SIGINT);
+  t1= t0;
+  for (int i= 0; i<n; i++) {
+    if (read(done[0], &t, sizeof(t))!=sizeof(t))
+      break;
+    if (t>t1)
+      t1= t;
+  }
+  close(done[0]);
+
+  kill(-pgid, SIGKILL);
+  for (int i= 0; i<n; i++)
+    wait(NULL);
+
+  printf("%6d readers: %9.3f ms total, %7.3f us per reader\n",
+         n, t1-t0, (t1-t0)*1e3/n);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  static int defaults[]= { 1000, 2000, 4000, 8000 };
+
+  if (argc>1) {
+    for (int i= 1; i<argc; i++)
+      if (stress(atoi(argv[i]))<0)
+        return 1;
+  }
+  else {
+    for (int i= 0; i<sizeof(defaults)/sizeof(defaults[0]); i++)
+      if (stress(defaults[i])<0)
+        return 1;
+  }
+  return 0;
+}
@@ -2,37 +2,115 @@
 #include <linux/init.h>
 /* #include <linux/config.h> */
 #include <linux/module.h>
-#include <linux/kernel.h> /* printk() */
+#include <linux/kernel.h> /* printk(), pr_debug() */
 #include <linux/slab.h> /* kmalloc() */
 #include <linux/fs.h> /* everything... */
+#include <linux/cdev.h>
 #include <linux/errno.h> /* error codes */
 #include <linux/types.h> /* size_t */
 #include <linux/proc_fs.h>
-#include <linux/fcntl.h> /* O_ACCMODE */
-#include <linux/uaccess.h> /* copy_from/to_user */
+#include <linux/fcntl.h> /* O_ACCMODE, O_NONBLOCK */
+#include <linux/limits.h> /* PIPE_BUF */
+#include <linux/jiffies.h> /* msecs_to_jiffies */
+#include <linux/vmalloc.h>
+#include <linux/log2.h> /* roundup_pow_of_two */
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uio.h> /* iov_iter */
+#include <linux/uaccess.h> /* copy_from_user, put_user */
+#include <linux/sched/signal.h> /* send_sig */
+#include <linux/mm.h> /* remap_vmalloc_range */
+#include <linux/atomic.h> /* atomic_t */
+#include <linux/compat.h> /* compat_ptr */
 
 #include "kmutex.h"
+#include "pipe.h"
 
 MODULE_LICENSE("Dual BSD/GPL");
 
 /* Declaration of pipe.c functions */
+typedef struct pipe Pipe;
 static int pipe_open(struct inode *inode, struct file *filp);
 static int pipe_release(struct inode *inode, struct file *filp);
-static ssize_t pipe_read(struct file *filp, char *buf, size_t count, loff_t *f_pos);
-static ssize_t pipe_write(struct file *filp, const char *buf, size_t count, loff_t *f_pos);
+static ssize_t pipe_read(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t pipe_write(struct kiocb *iocb, struct iov_iter *from);
+static long pipe_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+#ifdef CONFIG_COMPAT
+static long pipe_compat_ioctl(struct file *filp, unsigned int cmd,
+                              unsigned long arg);
+#endif
+static __poll_t pipe_poll(struct file *filp, poll_table *wait);
+static int pipe_mmap(struct file *filp, struct vm_area_struct *vma);
+static void pipe_vma_open(struct vm_area_struct *vma);
+static void pipe_vma_close(struct vm_area_struct *vma);
+static int pipe_setup(Pipe *pipe, int minor);
+static struct pipe_ring *alloc_ring(unsigned long bytes, unsigned *pcapacity);
+static ssize_t do_read(struct file *filp, struct iov_iter *to,
+                       int nonblock, unsigned *precords,
+                       unsigned __user *lengths);
+static int copy_out(Pipe *pipe, unsigned pos, struct iov_iter *to, int n);
+static int copy_in(Pipe *pipe, unsigned pos, struct iov_iter *from, int n);
+static int ring_get(Pipe *pipe, struct iov_iter *to, int n);
+static int ring_put(Pipe *pipe, struct iov_iter *from, int n);
+static unsigned get_length(Pipe *pipe, unsigned pos);
+static void put_length(Pipe *pipe, unsigned pos, unsigned len);
+static int get_record(Pipe *pipe, struct iov_iter *to, int whole);
+static int put_record(Pipe *pipe, struct iov_iter *from, int n);
+static void hangup(Pipe *pipe, unsigned tag);
+static int hungup(Pipe *pipe, unsigned tag);
+static int spsc(Pipe *pipe);
+static int nowait(struct kiocb *iocb);
+static unsigned available(Pipe *pipe, unsigned tag);
+static int claim(Pipe *pipe, int *turn, unsigned tag);
+static void unclaim(Pipe *pipe, int *turn, unsigned tag, int locked);
+static unsigned watermark(Pipe *pipe, unsigned tag, unsigned need,
+                          unsigned count);
+static int pipe_wait(Pipe *pipe, int *turn, unsigned tag, unsigned need,
+                     unsigned count, int locked);
+static void wake(Pipe *pipe, unsigned tag, int locked);
+static long set_size(Pipe *pipe, unsigned long arg);
+static long set_mark(Pipe *pipe, unsigned *mark, unsigned long arg);
+static long wait_ring(Pipe *pipe, unsigned tag, unsigned long need,
+                      int nonblock);
+static long wake_ring(Pipe *pipe, unsigned long tags);
+static long set_packet(Pipe *pipe, unsigned long arg);
+static long read_records(struct file *filp, unsigned long arg);
 
 void pipe_exit(void);
 int pipe_init(void);
 
 /* Structure that declares the usual file */
-/* access functions */
+/* access functions.  Con read_iter y write_iter el nucleo tambien ofrece
+ * readv, writev y splice, con las funciones genericas de splice: no hay
+ * traspaso de paginas.  splice/sendfile hacia el pipe copia los datos
+ * desde las paginas de origen al buffer, y splice desde el pipe los copia
+ * del buffer a paginas nuevas.  Cada byte se copia una vez en cada
+ * sentido, como con read y write, pero sin pasar por un buffer del
+ * usuario.  El buffer no puede prestar sus paginas al destino: una vez
+ * leidas se reusan, y un destino que las retiene (p.ej. un socket que
+ * espera la confirmacion) veria datos nuevos. */
 struct file_operations pipe_fops = {
-  read: pipe_read,
-  write: pipe_write,
+  read_iter: pipe_read,
+  write_iter: pipe_write,
+  splice_read: copy_splice_read,
+  splice_write: iter_file_splice_write,
+  unlocked_ioctl: pipe_ioctl,
+#ifdef CONFIG_COMPAT
+  compat_ioctl: pipe_compat_ioctl,
+#endif
+  poll: pipe_poll,
+  mmap: pipe_mmap,
   open: pipe_open,
   release: pipe_release
 };
 
+/* Cuentan las proyecciones del anillo que siguen vigentes, incluyendo las
+ * que hereda un fork */
+static const struct vm_operations_struct pipe_vm_ops = {
+  open: pipe_vma_open,
+  close: pipe_vma_close
+};
+
 /* Declaration of the init and exit functions */
 module_init(pipe_init);
 module_exit(pipe_exit);
@@ -46,52 +124,224 @@ module_exit(pipe_exit);
 
 int pipe_major = 61;     /* Major number */
 
-/* Buffer to store data */
-#define MAX_SIZE 10
+/* Cada minor es un pipe independiente, con su propio buffer y su propio
+ * mutex, de modo que los procesos que usan pipes distintos no compiten
+ * entre si */
+struct pipe {
+  /* Buffer to store data.  capacity es una potencia de 2.  ring->in y
+   * ring->out cuentan los bytes escritos y leidos sin dar la vuelta, de
+   * modo que el pipe tiene in-out bytes y se indexa el buffer con
+   * & (capacity-1).  Solo el escritor modifica in y solo el lector
+   * modifica out: cada uno publica su indice con smp_store_release despues
+   * de copiar los datos y lee el del otro con smp_load_acquire.  El
+   * encabezado ring y buffer estan en una misma area que un proceso puede
+   * proyectar con mmap (ver pipe.h), y maps cuenta esas proyecciones.
+   * capacity no se lee del encabezado, que el proceso puede alterar.
+   * pipe_mmap se invoca con mmap_lock, que una falla de pagina pide
+   * durante las copias que se hacen con mutex: en vez de mutex usa
+   * map_mutex, que nunca se tiene mientras se copian datos del usuario, y
+   * PIPE_SET_SIZE pide ambos para cambiar ring y capacity. */
+  struct pipe_ring *ring;
+  char *buffer;
+  unsigned capacity;
+  atomic_t maps;
+  KMutex map_mutex;
+
+  /* El turno de cada lado: solo quien tiene reading lee del buffer y solo
+   * quien tiene writing escribe en el (ver claim).  Un lector y un
+   * escritor nunca compiten por un turno. */
+  int reading, writing;
+
+  /* El mutex y la condicion del pipe.  Lectores y escritores esperan en
+   * la misma condicion, pero con etiquetas distintas para que un escritor
+   * no despierte a los otros escritores ni un lector a los otros
+   * lectores.  Con un solo lector y un solo escritor abiertos, read y
+   * write no piden el mutex salvo para dormir: basta su turno.
+   * ring->waiting indica quienes duermen en cond (READER y/o WRITER), y
+   * ring->read_want y ring->write_want cuantos bytes para leer o escribir
+   * esperan (ver watermark).  Estan en el encabezado para que un proceso
+   * que usa el anillo sepa cuando despertarlos. */
+  KMutex mutex;
+  KCondition cond;
+  unsigned lowat, hiwat; /* las marcas de agua (ver pipe.h) */
+  int packet; /* el buffer guarda registros (ver PIPE_SET_PACKET) */
+  int readers, writers; /* archivos abiertos para leer y para escribir */
+  unsigned closed; /* READER y/o WRITER: ese lado cerro (ver hangup) */
+
+  /* poll/select/epoll no pueden esperar en una KCondition: los procesos
+   * que esperan que haya datos o espacio sin bloquearse en read o write
+   * esperan en estas colas, que se despiertan junto con cond. */
+  wait_queue_head_t read_queue;  /* esperan POLLIN */
+  wait_queue_head_t write_queue; /* esperan POLLOUT */
+
+  char name[16]; /* del mutex en debugfs: pipe0, pipe1, ... */
+};
+
+#define READER PIPE_READER /* espera que haya datos */
+#define WRITER PIPE_WRITER /* espera que haya espacio */
+#define READING 4 /* espera el turno de los lectores */
+#define WRITING 8 /* espera el turno de los escritores */
+
+static Pipe *pipes;        /* uno por minor */
+static struct cdev pipe_cdev;
+static int cdev_added= FALSE;
+static KStatsDir stats_dir;
+
+/* Numero de pipes: /dev/pipe0 es el minor 0, /dev/pipe1 el minor 1, ... */
+static int nr_pipes = 4;
+module_param(nr_pipes, int, 0444);
+MODULE_PARM_DESC(nr_pipes, "number of independent pipes (minors)");
+
+/* Con prio_queue=1 el mutex se entrega al proceso de mayor prioridad (ver
+ * KMUTEX_PRIO en kmutex.h), para que un lector de tiempo real no espere
+ * detras de los procesos normales que usan el mismo pipe. */
+static int prio_queue = 0;
+module_param(prio_queue, int, 0444);
+MODULE_PARM_DESC(prio_queue, "hand the mutex over by scheduling priority (1) or in FIFO order (0)");
 
-static char *pipe_buffer;
-static int in, out, size;
+/* lock_policy elige que hace m_unlock si hay procesos esperando el mutex
+ * (ver "Politica de entrega" en kmutex.h): 0 se lo cede al primero, 1 solo
+ * lo despierta y deja que un proceso en ejecucion lo tome (KMUTEX_BARGE),
+ * 2 igual que 1 pero sin que nadie espere mas de max_wait_ms
+ * (KMUTEX_BOUNDED).  No se usa con prio_queue=1. */
+static int lock_policy = 0;
+module_param(lock_policy, int, 0444);
+MODULE_PARM_DESC(lock_policy, "hand the mutex over (0), let running processes barge in (1) or barge with a bounded wait (2)");
+static int max_wait_ms = 0;
+module_param(max_wait_ms, int, 0444);
+MODULE_PARM_DESC(max_wait_ms, "longest wait in ms before barging stops with lock_policy=2 (0: KMUTEX_MAX_WAIT_MS)");
 
-/* El mutex y la condicion para pipe */
-static KMutex mutex;
-static KCondition cond;
+/* Capacidad inicial del buffer, que se puede cambiar con PIPE_SET_SIZE */
+static int pipe_size = PIPE_DEF_SIZE;
+module_param(pipe_size, int, 0444);
+MODULE_PARM_DESC(pipe_size, "initial buffer capacity in bytes, rounded up to a power of 2");
+
+/* Las marcas de agua iniciales (ver PIPE_SET_LOWAT en pipe.h) y el plazo
+ * en que se entregan los datos que no alcanzan la marca.  Esa espera se
+ * interrumpe con senales, como c_wait, y esta acotada por flush_ms. */
+static int low_watermark = 1;
+module_param(low_watermark, int, 0444);
+MODULE_PARM_DESC(low_watermark, "bytes in the pipe before a sleeping reader is woken");
+static int high_watermark = PIPE_MAX_SIZE;
+module_param(high_watermark, int, 0444);
+MODULE_PARM_DESC(high_watermark, "bytes left in the pipe before a sleeping writer is woken");
+static int flush_ms = 10;
+module_param(flush_ms, int, 0444);
+MODULE_PARM_DESC(flush_ms, "longest wait in ms for a watermark when some data or space is available");
 
 int pipe_init(void) {
   int rc;
+  dev_t dev= MKDEV(pipe_major, 0);
+
+  if (nr_pipes<1 || nr_pipes>256) {
+    printk("<1>pipe: nr_pipes must be between 1 and 256\n");
+    return -EINVAL;
+  }
+  if (pipe_size<0 || pipe_size>PIPE_MAX_SIZE) {
+    printk("<1>pipe: pipe_size must be at most %d\n", PIPE_MAX_SIZE);
+    return -EINVAL;
+  }
+  if (low_watermark<1 || low_watermark>PIPE_MAX_SIZE ||
+      high_watermark<0 || high_watermark>PIPE_MAX_SIZE || flush_ms<1) {
+    printk("<1>pipe: watermarks must be at most %d, low_watermark and "
+           "flush_ms at least 1\n", PIPE_MAX_SIZE);
+    return -EINVAL;
+  }
 
   /* Registering device */
-  rc = register_chrdev(pipe_major, "pipe", &pipe_fops);
+  rc = register_chrdev_region(dev, nr_pipes, "pipe");
   if (rc < 0) {
     printk(
       "<1>pipe: cannot obtain major number %d\n", pipe_major);
     return rc;
   }
+  m_stats_init(&stats_dir, "pipe");
 
-  in= out= size= 0;
-  m_init(&mutex);
-  c_init(&cond);
+  /* Allocating the pipes */
+  pipes = kcalloc(nr_pipes, sizeof(Pipe), GFP_KERNEL);
+  if (pipes==NULL) {
+    rc = -ENOMEM;
+    goto fail;
+  }
+  for (int i= 0; i<nr_pipes; i++) {
+    rc = pipe_setup(&pipes[i], i);
+    if (rc < 0)
+      goto fail;
+  }
+
+  /* Los pipes quedan disponibles recien aqui */
+  cdev_init(&pipe_cdev, &pipe_fops);
+  pipe_cdev.owner = THIS_MODULE;
+  rc = cdev_add(&pipe_cdev, dev, nr_pipes);
+  if (rc < 0)
+    goto fail;
+  cdev_added= TRUE;
 
-  /* Allocating pipe_buffer */
-  pipe_buffer = kmalloc(MAX_SIZE, GFP_KERNEL);
-  if (pipe_buffer==NULL) {
+  printk("<1>Inserting pipe module with %d pipes\n", nr_pipes);
+  return 0;
+
+  fail:
     pipe_exit();
-    return -ENOMEM;
-  }
-  memset(pipe_buffer, 0, MAX_SIZE);
+    return rc;
+}
 
-  printk("<1>Inserting pipe module\n");
+/* Inicializa el pipe del minor minor */
+static int pipe_setup(Pipe *pipe, int minor) {
+  unsigned flags= 0;
+
+  pipe->reading= pipe->writing= 0;
+  atomic_set(&pipe->maps, 0);
+  pipe->packet= FALSE;
+  pipe->lowat= low_watermark;
+  pipe->hiwat= high_watermark;
+  pipe->readers= pipe->writers= 0;
+  pipe->closed= 0;
+  if (prio_queue)
+    flags= KMUTEX_PRIO;
+  else if (lock_policy==1)
+    flags= KMUTEX_BARGE;
+  else if (lock_policy==2)
+    flags= KMUTEX_BOUNDED;
+  m_init_flags(&pipe->mutex, flags);
+  if (max_wait_ms>0)
+    pipe->mutex.max_wait= msecs_to_jiffies(max_wait_ms);
+  m_init(&pipe->map_mutex);
+  c_init(&pipe->cond);
+  init_waitqueue_head(&pipe->read_queue);
+  init_waitqueue_head(&pipe->write_queue);
+  snprintf(pipe->name, sizeof(pipe->name), "pipe%d", minor);
+  m_stats_register(&stats_dir, pipe->name, &pipe->mutex);
+
+  pipe->ring= alloc_ring(pipe_size, &pipe->capacity);
+  if (pipe->ring==NULL)
+    return -ENOMEM;
+  pipe->buffer= (char *)pipe->ring+PIPE_RING_DATA;
   return 0;
 }
 
 void pipe_exit(void) {
-  /* Freeing the major number */
-  unregister_chrdev(pipe_major, "pipe");
+  unsigned long skipped= 0;
 
-  /* Freeing buffer pipe */
-  if (pipe_buffer) {
-    kfree(pipe_buffer);
+  if (cdev_added) {
+    cdev_del(&pipe_cdev);
+    cdev_added= FALSE;
   }
+  m_stats_exit(&stats_dir);
 
+  /* Freeing the pipes */
+  if (pipes) {
+    for (int i= 0; i<nr_pipes; i++) {
+      vfree(pipes[i].ring);
+      skipped+= pipes[i].cond.skipped;
+    }
+    kfree(pipes);
+    pipes = NULL;
+  }
+
+  /* Freeing the major number */
+  unregister_chrdev_region(MKDEV(pipe_major, 0), nr_pipes);
+
+  printk("<1>pipe: %lu useless wakeups avoided\n", skipped);
   printk("<1>Removing pipe module\n");
 }
 
@@ -99,85 +349,847 @@ static int pipe_open(struct inode *inode, struct file *filp) {
   char *mode=   filp->f_mode & FMODE_WRITE ? "write" :
                 filp->f_mode & FMODE_READ ? "read" :
                 "unknown";
-  printk("<1>open %p for %s\n", filp, mode);
+  /* cdev solo entrega los minors entre 0 y nr_pipes-1 */
+  Pipe *pipe= &pipes[iminor(inode)];
+  filp->private_data= pipe;
+  m_lock(&pipe->mutex);
+  if (filp->f_mode & FMODE_READ) {
+    WRITE_ONCE(pipe->readers, pipe->readers+1);
+    WRITE_ONCE(pipe->closed, pipe->closed & ~READER);
+  }
+  if (filp->f_mode & FMODE_WRITE) {
+    WRITE_ONCE(pipe->writers, pipe->writers+1);
+    WRITE_ONCE(pipe->closed, pipe->closed & ~WRITER);
+  }
+  m_unlock(&pipe->mutex);
+  printk("<1>open %p for %s on pipe %d\n", filp, mode, iminor(inode));
   return 0;
 }
 
 static int pipe_release(struct inode *inode, struct file *filp) {
+  Pipe *pipe= filp->private_data;
+  m_lock(&pipe->mutex);
+  if (filp->f_mode & FMODE_READ) {
+    WRITE_ONCE(pipe->readers, pipe->readers-1);
+    if (pipe->readers==0)
+      hangup(pipe, READER);
+  }
+  if (filp->f_mode & FMODE_WRITE) {
+    WRITE_ONCE(pipe->writers, pipe->writers-1);
+    if (pipe->writers==0)
+      hangup(pipe, WRITER);
+  }
+  if (pipe->readers==0 && pipe->writers==0) {
+    /* Nadie tiene abierto el pipe.  Si quedan datos, el proximo lector
+     * los recibe y despues el fin de archivo; si no, el pipe vuelve a
+     * empezar y un lector espera al proximo escritor.  Un escritor nunca
+     * recibe EPIPE antes de que un lector abra el pipe. */
+    WRITE_ONCE(pipe->closed, available(pipe, READER)>0 ?
+                             pipe->closed & WRITER : 0);
+  }
+  m_unlock(&pipe->mutex);
   printk("<1>release %p\n", filp);
   return 0;
 }
 
-static ssize_t pipe_read(struct file *filp, char *buf,
-                    size_t ucount, loff_t *f_pos) {
-  ssize_t count= ucount;
+/* Se cerro el ultimo archivo del lado tag (READER o WRITER), teniendo el
+ * mutex: despierta al otro lado, en cond y con poll, para que un lector
+ * reciba el fin de archivo cuando vacie el pipe y un escritor EPIPE.  No
+ * importa cuanto esperaban (ver watermark). */
+static void hangup(Pipe *pipe, unsigned tag) {
+  unsigned other= tag==READER ? WRITER : READER;
+  WRITE_ONCE(pipe->closed, pipe->closed | tag);
+  WRITE_ONCE(pipe->ring->waiting, pipe->ring->waiting & ~other);
+  c_broadcast_tag(&pipe->cond, other);
+  if (other==READER)
+    wake_up_interruptible_poll(&pipe->read_queue, EPOLLHUP);
+  else
+    wake_up_interruptible_poll(&pipe->write_queue, EPOLLERR);
+}
 
-  printk("<1>read %p %ld\n", filp, count);
-  m_lock(&mutex);
+/* Indica si el otro lado de quien espera datos (tag READER) o espacio
+ * (WRITER) ya cerro el pipe: el lector no recibira mas datos y lo que
+ * escriba el escritor nadie lo leera.  Un archivo abierto con O_RDWR
+ * cuenta en ambos lados, de modo que quien lo tiene abierto nunca ve
+ * cerrado el pipe. */
+static int hungup(Pipe *pipe, unsigned tag) {
+  return READ_ONCE(pipe->closed) & (tag==READER ? WRITER : READER);
+}
 
-  while (size==0) {
-    /* si no hay nada en el buffer, el lector espera */
-    if (c_wait(&cond, &mutex)) {
-      printk("<1>read interrupted\n");
+/* Con un solo lector y un solo escritor abiertos, read y write solo
+ * toman su turno, sin el mutex, si esta libre.  Los contadores son solo
+ * una pista: varios threads o procesos pueden compartir el mismo archivo
+ * abierto, y el turno es lo que impide que lean o escriban a la vez. */
+static int spsc(Pipe *pipe) {
+  return READ_ONCE(pipe->readers)==1 && READ_ONCE(pipe->writers)==1;
+}
+
+/* Con O_NONBLOCK o con IOCB_NOWAIT, read y write no esperan.
+ * SPLICE_F_NONBLOCK no llega hasta aqui: copy_splice_read e
+ * iter_file_splice_write no lo traducen a IOCB_NOWAIT, por lo que splice
+ * solo deja de esperar si /dev/pipe se abrio con O_NONBLOCK */
+static int nowait(struct kiocb *iocb) {
+  return (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+         (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+static ssize_t pipe_read(struct kiocb *iocb, struct iov_iter *to) {
+  return do_read(iocb->ki_filp, to, nowait(iocb), NULL, NULL);
+}
+
+/* Lee del pipe de filp hacia to, esperando que haya datos salvo con
+ * nonblock.  En modo paquete entrega un registro, o con precords todos
+ * los registros completos que quepan en to, hasta *precords, y deja sus
+ * largos en lengths y en *precords cuantos son (PIPE_READ_RECORDS). */
+static ssize_t do_read(struct file *filp, struct iov_iter *to,
+                       int nonblock, unsigned *precords,
+                       unsigned __user *lengths) {
+  Pipe *pipe= filp->private_data;
+  ssize_t count= iov_iter_count(to);
+  unsigned size, copied, records= 0;
+  int locked;
+
+  pr_debug("read %p %ld\n", filp, count);
+  if (count==0 && precords==NULL) {
+    /* como en Linux, no se toca el pipe: en modo paquete se descartaria
+     * un registro */
+    return 0;
+  }
+  locked= !spsc(pipe) || cmpxchg(&pipe->reading, 0, 1)!=0;
+  if (locked) {
+    m_lock(&pipe->mutex);
+    if (claim(pipe, &pipe->reading, READING)) {
       count= -EINTR;
+      goto unlock;
+    }
+  }
+
+  size= available(pipe, READER);
+  if (size==0 && !hungup(pipe, READER)) {
+    /* si no hay nada en el buffer, el lector espera, salvo con O_NONBLOCK */
+    if (nonblock) {
+      count= -EAGAIN;
       goto epilog;
     }
+    if (pipe_wait(pipe, &pipe->reading, READER, 1, count, locked)) {
+      printk("<1>read interrupted\n");
+      count= -EINTR;
+      goto unlock;
+    }
+    size= available(pipe, READER);
+  }
+  if (size==0) {
+    /* fin de archivo: los escritores cerraron el pipe y no quedan datos */
+    if (precords)
+      *precords= 0;
+    count= 0;
+    goto epilog;
   }
 
-  if (count > size) {
-    count= size;
+  if (precords && !pipe->packet) {
+    /* PIPE_SET_PACKET cambio el modo */
+    count= -EINVAL;
+    goto epilog;
   }
+  if (pipe->packet) {
+    /* el escritor publica cada registro completo */
+    unsigned max= precords ? *precords : 1;
+    copied= 0;
+    while (records<max && available(pipe, READER)>0) {
+      int n= get_record(pipe, to, precords!=NULL);
+      if (n<0) {
+        if (records==0) {
+          count= n;
+          goto epilog;
+        }
+        break; /* el siguiente no cabe o falla: queda para la proxima */
+      }
+      if (lengths && put_user(n, &lengths[records])) {
+        count= -EFAULT;
+        goto epilog;
+      }
+      copied+= n;
+      records++;
+    }
+    if (precords)
+      *precords= records;
+  }
+  else {
+    if (count > size) {
+      count= size;
+    }
 
-  /* Transfiriendo datos hacia el espacio del usuario */
-  for (int k= 0; k<count; k++) {
-    if (copy_to_user(buf+k, pipe_buffer+out, 1)!=0) {
-      /* el valor de buf es una direccion invalida */
+    /* Transfiriendo datos hacia el espacio del usuario.  Si una direccion
+     * no es valida, se entrega lo que se alcanzo a copiar. */
+    copied= ring_get(pipe, to, count);
+    if (copied==0 && count>0) {
       count= -EFAULT;
       goto epilog;
     }
-    printk("<1>read byte %c (%d) from %d\n",
-            pipe_buffer[out], pipe_buffer[out], out);
-    out= (out+1)%MAX_SIZE;
-    size--;
   }
+  count= copied;
+  pr_debug("read %ld bytes, next at %u\n", count,
+           pipe->ring->out & (pipe->capacity-1));
+  wake(pipe, WRITER, locked);
 
 epilog:
-  c_broadcast(&cond);
-  m_unlock(&mutex);
+  unclaim(pipe, &pipe->reading, READING, locked);
+unlock:
+  if (locked)
+    m_unlock(&pipe->mutex);
   return count;
 }
 
-static ssize_t pipe_write( struct file *filp, const char *buf,
-                      size_t ucount, loff_t *f_pos) {
-  ssize_t count= ucount;
+static ssize_t pipe_write(struct kiocb *iocb, struct iov_iter *from) {
+  struct file *filp= iocb->ki_filp;
+  Pipe *pipe= filp->private_data;
+  ssize_t count= iov_iter_count(from);
+  ssize_t k= 0, rc= 0;
+  int locked= !spsc(pipe) || cmpxchg(&pipe->writing, 0, 1)!=0;
 
-  printk("<1>write %p %ld\n", filp, count);
-  m_lock(&mutex);
+  pr_debug("write %p %ld\n", filp, count);
+  if (locked) {
+    m_lock(&pipe->mutex);
+    if (claim(pipe, &pipe->writing, WRITING)) {
+      rc= -EINTR;
+      goto unlock;
+    }
+  }
 
-  for (int k= 0; k<count; k++) {
-    while (size==MAX_SIZE) {
-      /* si el buffer esta lleno, el escritor espera */
-      if (c_wait(&cond, &mutex)) {
-        printk("<1>write interrupted\n");
-        count= -EINTR;
+  while (k<count) {
+    unsigned room, n, need, copied;
+    /* Mientras el escritor duerme sin su turno, PIPE_SET_PACKET y
+     * PIPE_SET_SIZE pueden cambiar el modo y la capacidad: se revisan en
+     * cada vuelta. */
+    int packet= READ_ONCE(pipe->packet);
+    if (packet) {
+      /* en modo paquete lo que falta es un registro, que se escribe
+       * completo */
+      need= count-k+PIPE_RECORD_HDR;
+      if (need > pipe->capacity) {
+        rc= -EMSGSIZE;
         goto epilog;
       }
     }
+    else {
+      /* Como en POSIX, un write de hasta PIPE_BUF bytes es atomico: se
+       * espera hasta que quepa completo.  Uno mas grande escribe lo que
+       * quepa. */
+      need= count<=PIPE_BUF ? count : 1;
+    }
+    if (hungup(pipe, WRITER)) {
+      /* como en POSIX, nadie leera lo que se escriba */
+      send_sig(SIGPIPE, current, 0);
+      rc= -EPIPE;
+      goto epilog;
+    }
+    room= available(pipe, WRITER);
+    if (room < need) {
+      /* si el buffer esta lleno, el escritor espera, salvo con
+       * O_NONBLOCK */
+      if (nowait(iocb)) {
+        rc= -EAGAIN;
+        goto epilog;
+      }
+      if (pipe_wait(pipe, &pipe->writing, WRITER, need, need, locked)) {
+        printk("<1>write interrupted\n");
+        rc= -EINTR;
+        goto unlock;
+      }
+      continue; /* tambien despierta si los lectores cerraron el pipe */
+    }
 
-    if (copy_from_user(pipe_buffer+in, buf+k, 1)!=0) {
-      /* el valor de buf es una direccion invalida */
-      count= -EFAULT;
+    /* se escribe todo lo que cabe de una vez */
+    if (packet) {
+      n= count-k;
+      copied= put_record(pipe, from, n);
+    }
+    else {
+      n= count-k < room ? count-k : room;
+      copied= ring_put(pipe, from, n);
+    }
+    pr_debug("write %u bytes, next at %u\n", copied,
+             pipe->ring->in & (pipe->capacity-1));
+    k+= copied;
+    if (copied>0)
+      wake(pipe, READER, locked);
+    if (copied<n) {
+      /* una direccion de origen no es valida */
+      rc= -EFAULT;
       goto epilog;
     }
-    printk("<1>write byte %c (%d) at %d\n",
-           pipe_buffer[in], pipe_buffer[in], in);
-    in= (in+1)%MAX_SIZE;
-    size++;
-    c_broadcast(&cond);
   }
 
 epilog:
-  m_unlock(&mutex);
-  return count;
+  unclaim(pipe, &pipe->writing, WRITING, locked);
+unlock:
+  if (locked)
+    m_unlock(&pipe->mutex);
+  /* si se alcanzo a escribir algo, se informa cuanto, como en POSIX */
+  return k>0 ? k : rc;
+}
+
+static long pipe_ioctl(struct file *filp, unsigned int cmd,
+                       unsigned long arg) {
+  Pipe *pipe= filp->private_data;
+
+  switch (cmd) {
+  case PIPE_GET_SIZE:
+    return READ_ONCE(pipe->capacity);
+  case PIPE_SET_SIZE:
+    return set_size(pipe, arg);
+  case PIPE_GET_LOWAT:
+    return READ_ONCE(pipe->lowat);
+  case PIPE_SET_LOWAT:
+    return arg==0 ? -EINVAL : set_mark(pipe, &pipe->lowat, arg);
+  case PIPE_GET_HIWAT:
+    return READ_ONCE(pipe->hiwat);
+  case PIPE_SET_HIWAT:
+    return set_mark(pipe, &pipe->hiwat, arg);
+  case PIPE_WAIT_READ:
+    return wait_ring(pipe, READER, arg, filp->f_flags & O_NONBLOCK);
+  case PIPE_WAIT_WRITE:
+    return wait_ring(pipe, WRITER, arg, filp->f_flags & O_NONBLOCK);
+  case PIPE_WAKE:
+    return wake_ring(pipe, arg);
+  case PIPE_GET_PACKET:
+    return READ_ONCE(pipe->packet);
+  case PIPE_SET_PACKET:
+    return set_packet(pipe, arg);
+  case PIPE_READ_RECORDS:
+    return read_records(filp, arg);
+  default:
+    return -ENOTTY;
+  }
+}
+
+#ifdef CONFIG_COMPAT
+/* ioctl de un proceso de 32 bits.  Solo PIPE_READ_RECORDS recibe un
+ * puntero, que se convierte con compat_ptr; los demas reciben un entero,
+ * que pasa sin cambios. */
+static long pipe_compat_ioctl(struct file *filp, unsigned int cmd,
+                              unsigned long arg) {
+  if (cmd==PIPE_READ_RECORDS)
+    arg= (unsigned long)compat_ptr(arg);
+  return pipe_ioctl(filp, cmd, arg);
+}
+#endif
+
+static long set_size(Pipe *pipe, unsigned long arg) {
+  long rc;
+  unsigned new_capacity, size, out, first;
+  struct pipe_ring *new_ring, *old_ring;
+  char *new_buffer;
+
+  if (arg>PIPE_MAX_SIZE)
+    return -EINVAL;
+  /* vmalloc puede demorar: se pide el nuevo buffer sin tener el mutex */
+  new_ring= alloc_ring(arg, &new_capacity);
+  if (new_ring==NULL)
+    return -ENOMEM;
+  new_buffer= (char *)new_ring+PIPE_RING_DATA;
+
+  /* con los dos turnos nadie esta copiando datos del buffer, y sin
+   * proyecciones ningun proceso lo usa como anillo */
+  old_ring= new_ring;
+  m_lock(&pipe->mutex);
+  if (claim(pipe, &pipe->reading, READING)) {
+    rc= -EINTR;
+    goto unlock;
+  }
+  if (claim(pipe, &pipe->writing, WRITING)) {
+    rc= -EINTR;
+    goto unclaim_reading;
+  }
+  size= available(pipe, READER);
+  m_lock(&pipe->map_mutex);
+  if (size>new_capacity || atomic_read(&pipe->maps)>0) {
+    m_unlock(&pipe->map_mutex);
+    rc= -EBUSY;
+    goto epilog;
+  }
+  /* los datos quedan al comienzo del nuevo buffer */
+  out= pipe->ring->out & (pipe->capacity-1);
+  first= size < pipe->capacity-out ? size : pipe->capacity-out;
+  memcpy(new_buffer, pipe->buffer+out, first);
+  memcpy(new_buffer+first, pipe->buffer, size-first);
+  new_ring->in= size;
+  new_ring->waiting= pipe->ring->waiting;
+  new_ring->read_want= pipe->ring->read_want;
+  new_ring->write_want= pipe->ring->write_want;
+  old_ring= pipe->ring;
+  pipe->ring= new_ring;
+  pipe->buffer= new_buffer;
+  WRITE_ONCE(pipe->capacity, new_capacity);
+  m_unlock(&pipe->map_mutex);
+  printk("<1>%s: capacity %u bytes\n", pipe->name, pipe->capacity);
+  /* Los que duermen vuelven a calcular cuanto esperan: puede haber
+   * espacio para los escritores, o lo que espera un escritor en modo
+   * paquete puede ya no caber. */
+  WRITE_ONCE(pipe->ring->waiting, 0);
+  c_broadcast_tag(&pipe->cond, READER | WRITER);
+  wake(pipe, WRITER, TRUE);
+  rc= pipe->capacity;
+
+epilog:
+  unclaim(pipe, &pipe->writing, WRITING, TRUE);
+unclaim_reading:
+  unclaim(pipe, &pipe->reading, READING, TRUE);
+unlock:
+  m_unlock(&pipe->mutex);
+  vfree(old_ring);
+  return rc;
+}
+
+static long set_mark(Pipe *pipe, unsigned *mark, unsigned long arg) {
+  if (arg>PIPE_MAX_SIZE)
+    return -EINVAL;
+  m_lock(&pipe->mutex);
+  WRITE_ONCE(*mark, arg);
+  /* los que duermen vuelven a calcular cuanto esperan */
+  WRITE_ONCE(pipe->ring->waiting, 0);
+  c_broadcast_tag(&pipe->cond, READER | WRITER);
+  m_unlock(&pipe->mutex);
+  return arg;
+}
+
+/* PIPE_WAIT_READ (tag READER) y PIPE_WAIT_WRITE (WRITER): espera como
+ * read o write que haya need bytes para leer o escribir y retorna cuantos
+ * hay.  Un proceso que usa el anillo no tiene el turno de su lado, pero
+ * pipe_wait lo necesita: se toma solo mientras se espera. */
+static long wait_ring(Pipe *pipe, unsigned tag, unsigned long need,
+                      int nonblock) {
+  int *turn= tag==READER ? &pipe->reading : &pipe->writing;
+  unsigned turn_tag= tag==READER ? READING : WRITING;
+  long rc;
+
+  m_lock(&pipe->mutex);
+  if (need==0 || need>pipe->capacity) {
+    rc= -EINVAL;
+    goto unlock;
+  }
+  if (claim(pipe, turn, turn_tag)) {
+    rc= -EINTR;
+    goto unlock;
+  }
+  rc= available(pipe, tag);
+  if (rc<need) {
+    if (nonblock) {
+      rc= -EAGAIN;
+      goto epilog;
+    }
+    if (pipe_wait(pipe, turn, tag, need, need, TRUE)) {
+      rc= -EINTR;
+      goto unlock;
+    }
+    rc= available(pipe, tag);
+  }
+
+epilog:
+  unclaim(pipe, turn, turn_tag, TRUE);
+unlock:
+  m_unlock(&pipe->mutex);
+  return rc;
+}
+
+/* PIPE_WAKE: un proceso que usa el anillo publico in o out y despierta a
+ * los que esperan datos (PIPE_READER) y/o espacio (PIPE_WRITER) */
+static long wake_ring(Pipe *pipe, unsigned long tags) {
+  if (tags==0 || (tags & ~(unsigned long)(READER | WRITER)))
+    return -EINVAL;
+  m_lock(&pipe->mutex);
+  if (tags & READER)
+    wake(pipe, READER, TRUE);
+  if (tags & WRITER)
+    wake(pipe, WRITER, TRUE);
+  m_unlock(&pipe->mutex);
+  return 0;
+}
+
+/* PIPE_SET_PACKET: con los dos turnos nadie esta copiando datos, y en un
+ * pipe vacio no quedan datos del modo anterior.  Un lector o un escritor
+ * puede estar durmiendo en pipe_wait, que devuelve el turno: al despertar
+ * vuelve a leer el modo (ver pipe_write). */
+static long set_packet(Pipe *pipe, unsigned long arg) {
+  long rc;
+
+  if (arg>1)
+    return -EINVAL;
+  m_lock(&pipe->mutex);
+  if (claim(pipe, &pipe->reading, READING)) {
+    rc= -EINTR;
+    goto unlock;
+  }
+  if (claim(pipe, &pipe->writing, WRITING)) {
+    rc= -EINTR;
+    goto unclaim_reading;
+  }
+  if (available(pipe, READER)>0) {
+    rc= -EBUSY;
+    goto epilog;
+  }
+  WRITE_ONCE(pipe->packet, arg);
+  rc= arg;
+
+epilog:
+  unclaim(pipe, &pipe->writing, WRITING, TRUE);
+unclaim_reading:
+  unclaim(pipe, &pipe->reading, READING, TRUE);
+unlock:
+  m_unlock(&pipe->mutex);
+  return rc;
+}
+
+/* PIPE_READ_RECORDS: como read, pero entrega todos los registros
+ * completos que quepan (ver pipe.h) */
+static long read_records(struct file *filp, unsigned long arg) {
+  struct pipe_records __user *urecs= (struct pipe_records __user *)arg;
+  struct pipe_records recs;
+  struct iov_iter to;
+  long rc;
+
+  if (copy_from_user(&recs, urecs, sizeof(recs)))
+    return -EFAULT;
+  if (recs.count==0)
+    return -EINVAL;
+  rc= import_ubuf(ITER_DEST, u64_to_user_ptr(recs.buf), recs.size, &to);
+  if (rc<0)
+    return rc;
+  rc= do_read(filp, &to, filp->f_flags & O_NONBLOCK, &recs.count,
+              u64_to_user_ptr(recs.lengths));
+  if (rc>=0 && put_user(recs.count, &urecs->count))
+    rc= -EFAULT;
+  return rc;
+}
+
+/* Un archivo abierto para leer se puede leer sin bloquearse si hay datos,
+ * y uno abierto para escribir se puede escribir si hay espacio.  Si el
+ * otro lado cerro el pipe, como con un pipe de Linux, el lector recibe
+ * EPOLLHUP y el escritor EPOLLERR.  poll_wait no se bloquea: solo
+ * inscribe la cola en wait, y poll, select o epoll vuelven a invocar
+ * pipe_poll cuando pipe_read, pipe_write o pipe_release la despiertan.  Se
+ * lee el encabezado con el mutex porque PIPE_SET_SIZE lo puede
+ * reemplazar. */
+static __poll_t pipe_poll(struct file *filp, poll_table *wait) {
+  Pipe *pipe= filp->private_data;
+  __poll_t mask= 0;
+  if (filp->f_mode & FMODE_READ)
+    poll_wait(filp, &pipe->read_queue, wait);
+  if (filp->f_mode & FMODE_WRITE)
+    poll_wait(filp, &pipe->write_queue, wait);
+  /* wake solo despierta las colas que tienen procesos: la inscripcion
+   * debe ser visible antes de leer los indices (ver wake) */
+  smp_mb();
+  m_lock(&pipe->mutex);
+  if ((filp->f_mode & FMODE_READ) && available(pipe, READER)>0)
+    mask|= EPOLLIN | EPOLLRDNORM;
+  if ((filp->f_mode & FMODE_READ) && hungup(pipe, READER))
+    mask|= EPOLLHUP;
+  if ((filp->f_mode & FMODE_WRITE) && available(pipe, WRITER)>0)
+    mask|= EPOLLOUT | EPOLLWRNORM;
+  if ((filp->f_mode & FMODE_WRITE) && hungup(pipe, WRITER))
+    mask|= EPOLLERR;
+  m_unlock(&pipe->mutex);
+  return mask;
+}
+
+/* Proyecta el encabezado y el buffer del pipe en el proceso (ver
+ * pipe.h).  vmalloc_user dejo el area lista para remap_vmalloc_range.
+ * Con map_mutex PIPE_SET_SIZE no cambia el anillo mientras se proyecta
+ * (ver struct pipe). */
+static int pipe_mmap(struct file *filp, struct vm_area_struct *vma) {
+  Pipe *pipe= filp->private_data;
+  int rc;
+  /* con MAP_PRIVATE el proceso escribiria en copias de las paginas */
+  if (!(vma->vm_flags & VM_SHARED) || vma->vm_pgoff!=0)
+    return -EINVAL;
+  m_lock(&pipe->map_mutex);
+  if (vma->vm_end-vma->vm_start > PIPE_RING_DATA+pipe->capacity) {
+    rc= -EINVAL;
+    goto unlock;
+  }
+  rc= remap_vmalloc_range(vma, pipe->ring, 0);
+  if (rc<0)
+    goto unlock;
+  vma->vm_ops= &pipe_vm_ops;
+  vma->vm_private_data= pipe;
+  atomic_inc(&pipe->maps);
+  printk("<1>%s: mapped %lu bytes\n", pipe->name,
+         vma->vm_end-vma->vm_start);
+
+unlock:
+  m_unlock(&pipe->map_mutex);
+  return rc;
 }
 
+/* Tampoco piden un mutex: una proyeccion que ya existe impide que
+ * PIPE_SET_SIZE cambie el anillo */
+static void pipe_vma_open(struct vm_area_struct *vma) {
+  Pipe *pipe= vma->vm_private_data;
+  atomic_inc(&pipe->maps);
+}
+
+static void pipe_vma_close(struct vm_area_struct *vma) {
+  Pipe *pipe= vma->vm_private_data;
+  atomic_dec(&pipe->maps);
+}
+
+/* Pide un encabezado y un buffer de bytes redondeado hacia arriba a una
+ * potencia de 2, a lo menos PIPE_MIN_SIZE, y deja su tamano en
+ * *pcapacity.  El buffer empieza PIPE_RING_DATA bytes despues del
+ * encabezado.  Se usa vmalloc porque kmalloc no logra entregar varios MiB
+ * contiguos, y vmalloc_user para que el area se pueda proyectar en un
+ * proceso (y llegue en 0, sin datos de otros). */
+static struct pipe_ring *alloc_ring(unsigned long bytes,
+                                    unsigned *pcapacity) {
+  struct pipe_ring *ring;
+  if (bytes<PIPE_MIN_SIZE)
+    bytes= PIPE_MIN_SIZE;
+  *pcapacity= roundup_pow_of_two(bytes);
+  ring= vmalloc_user(PIPE_RING_DATA+*pcapacity);
+  if (ring!=NULL)
+    ring->capacity= *pcapacity;
+  return ring;
+}
+
+/* Copia n<=capacity bytes desde pipe->buffer a partir de la posicion pos
+ * hacia to: a lo mas dos trozos contiguos, el segundo si los datos dan la
+ * vuelta al final del buffer, cualquiera sea el numero de segmentos de
+ * to.  Retorna cuantos bytes copio, menos que n si una direccion de to no
+ * es valida. */
+static int copy_out(Pipe *pipe, unsigned pos, struct iov_iter *to, int n) {
+  unsigned at= pos & (pipe->capacity-1);
+  int first= n < pipe->capacity-at ? n : pipe->capacity-at;
+  int copied= copy_to_iter(pipe->buffer+at, first, to);
+  if (copied==first)
+    copied+= copy_to_iter(pipe->buffer, n-first, to);
+  return copied;
+}
+
+/* Copia n<=capacity bytes desde from hacia pipe->buffer a partir de la
+ * posicion pos, igual que copy_out */
+static int copy_in(Pipe *pipe, unsigned pos, struct iov_iter *from, int n) {
+  unsigned at= pos & (pipe->capacity-1);
+  int first= n < pipe->capacity-at ? n : pipe->capacity-at;
+  int copied= copy_from_iter(pipe->buffer+at, first, from);
+  if (copied==first)
+    copied+= copy_from_iter(pipe->buffer, n-first, from);
+  return copied;
+}
+
+/* Copia hacia to n<=in-out bytes a partir de out y los consume.  Retorna
+ * cuantos bytes copio y consumio.  Se necesita el turno de los
+ * lectores. */
+static int ring_get(Pipe *pipe, struct iov_iter *to, int n) {
+  unsigned out= pipe->ring->out;
+  int copied= copy_out(pipe, out, to, n);
+  /* el escritor no reusa el espacio antes de que terminen las copias */
+  smp_store_release(&pipe->ring->out, out+copied);
+  return copied;
+}
+
+/* Copia n<=capacity-(in-out) bytes desde from a partir de in y los
+ * publica.  Se necesita el turno de los escritores. */
+static int ring_put(Pipe *pipe, struct iov_iter *from, int n) {
+  unsigned in= pipe->ring->in;
+  int copied= copy_in(pipe, in, from, n);
+  /* el lector no ve el nuevo in antes que los datos */
+  smp_store_release(&pipe->ring->in, in+copied);
+  return copied;
+}
+
+/* El largo de un registro esta en sus primeros PIPE_RECORD_HDR bytes,
+ * que tambien pueden dar la vuelta al final del buffer */
+static unsigned get_length(Pipe *pipe, unsigned pos) {
+  unsigned len;
+  char *p= (char *)&len;
+  for (int i= 0; i<PIPE_RECORD_HDR; i++)
+    p[i]= pipe->buffer[(pos+i) & (pipe->capacity-1)];
+  return len;
+}
+
+static void put_length(Pipe *pipe, unsigned pos, unsigned len) {
+  char *p= (char *)&len;
+  for (int i= 0; i<PIPE_RECORD_HDR; i++)
+    pipe->buffer[(pos+i) & (pipe->capacity-1)]= p[i];
+}
+
+/* Copia hacia to el registro que esta en out y lo consume.  Si no cabe
+ * completo en to, con whole retorna -EMSGSIZE sin consumirlo, y si no
+ * copia lo que cabe y descarta el resto.  Retorna cuantos bytes copio, o
+ * -EFAULT sin consumirlo si no pudo copiar nada.  Si un proceso altero el
+ * anillo, el largo se acota a los datos que hay.  Se necesita el turno de
+ * los lectores y que haya datos. */
+static int get_record(Pipe *pipe, struct iov_iter *to, int whole) {
+  unsigned out= pipe->ring->out, size= available(pipe, READER);
+  unsigned len= get_length(pipe, out), n;
+  int copied;
+  if (size<PIPE_RECORD_HDR)
+    len= 0;
+  else if (len>size-PIPE_RECORD_HDR)
+    len= size-PIPE_RECORD_HDR;
+  n= len;
+  if (n>iov_iter_count(to)) {
+    if (whole)
+      return -EMSGSIZE;
+    n= iov_iter_count(to);
+  }
+  copied= copy_out(pipe, out+PIPE_RECORD_HDR, to, n);
+  if (copied==0 && n>0)
+    return -EFAULT;
+  smp_store_release(&pipe->ring->out, out+(size<PIPE_RECORD_HDR ? size :
+                                          PIPE_RECORD_HDR+len));
+  return copied;
+}
+
+/* Escribe desde from un registro de n bytes a partir de in y lo publica
+ * completo.  Si una direccion de from no es valida el registro queda con
+ * lo que se alcanzo a copiar, y si no se copio nada no se escribe.
+ * Retorna cuantos bytes copio.  Se necesita el turno de los escritores y
+ * espacio para n+PIPE_RECORD_HDR bytes. */
+static int put_record(Pipe *pipe, struct iov_iter *from, int n) {
+  unsigned in= pipe->ring->in;
+  int copied= copy_in(pipe, in+PIPE_RECORD_HDR, from, n);
+  if (copied==0)
+    return 0;
+  put_length(pipe, in, copied);
+  smp_store_release(&pipe->ring->in, in+PIPE_RECORD_HDR+copied);
+  return copied;
+}
+
+/* Los bytes que se pueden leer (tag READER) o escribir (WRITER).  Si un
+ * proceso altero los indices del anillo, nunca mas que capacity, para que
+ * ring_get y ring_put no salgan del buffer. */
+static unsigned available(Pipe *pipe, unsigned tag) {
+  struct pipe_ring *ring= pipe->ring;
+  unsigned size= smp_load_acquire(&ring->in)-smp_load_acquire(&ring->out);
+  if (size>pipe->capacity)
+    size= pipe->capacity;
+  return tag==READER ? size : pipe->capacity-size;
+}
+
+/* Toma el turno *turn (reading o writing) teniendo el mutex.  El turno
+ * vale 0 si esta libre, 1 si alguien lo tiene y 2 si ademas alguien lo
+ * espera en cond con la etiqueta tag (READING o WRITING), de modo que
+ * unclaim sabe si tiene que despertar a alguien.  Retorna -EINTR si
+ * recibe una senal antes de obtenerlo. */
+static int claim(Pipe *pipe, int *turn, unsigned tag) {
+  while (xchg(turn, 2)!=0) {
+    if (c_wait_tag(&pipe->cond, &pipe->mutex, tag))
+      return -EINTR;
+  }
+  return 0;
+}
+
+/* Devuelve el turno *turn.  locked indica si se tiene el mutex, que solo
+ * se pide si alguien espera el turno. */
+static void unclaim(Pipe *pipe, int *turn, unsigned tag, int locked) {
+  if (xchg(turn, 0)==2) {
+    if (!locked)
+      m_lock(&pipe->mutex);
+    c_broadcast_tag(&pipe->cond, tag);
+    if (!locked)
+      m_unlock(&pipe->mutex);
+  }
+}
+
+/* Cuantos bytes para leer (tag READER) o para escribir (WRITER) espera un
+ * proceso dormido segun las marcas de agua: un lector que pidio count
+ * bytes espera min(count, lowat) y un escritor espera que queden a lo mas
+ * hiwat bytes en el pipe.  Nunca menos que need ni mas que capacity. */
+static unsigned watermark(Pipe *pipe, unsigned tag, unsigned need,
+                          unsigned count) {
+  unsigned want, lowat= READ_ONCE(pipe->lowat), hiwat= READ_ONCE(pipe->hiwat);
+  if (tag==READER)
+    want= count<lowat ? count : lowat;
+  else
+    want= hiwat<pipe->capacity ? pipe->capacity-hiwat : 0;
+  if (want>pipe->capacity)
+    want= pipe->capacity;
+  return want>need ? want : need;
+}
+
+/* Espera que haya a lo menos need bytes para leer (tag READER) o para
+ * escribir (WRITER), teniendo el turno *turn.  Mientras duerme en cond
+ * devuelve el turno, para que otro proceso del mismo lado o PIPE_SET_SIZE
+ * puedan avanzar, y lo vuelve a tomar al despertar.  Si las marcas de agua
+ * piden mas que need, se espera a lo mas flush_ms por la marca; despues
+ * basta need.  Tambien retorna, con menos de need bytes, si el otro lado
+ * cerro el pipe (ver hangup) o si PIPE_SET_SIZE dejo la capacidad bajo
+ * need.  Retorna -EINTR, ya sin el turno, si recibe
+ * una senal.  locked indica si se tiene el mutex. */
+static int pipe_wait(Pipe *pipe, int *turn, unsigned tag, unsigned need,
+                     unsigned count, int locked) {
+  unsigned long deadline= jiffies+msecs_to_jiffies(flush_ms);
+  int flushed= FALSE;
+  int rc= 0;
+  if (!locked)
+    m_lock(&pipe->mutex);
+  for (;;) {
+    /* PIPE_SET_SIZE reemplaza el encabezado mientras no se tiene el turno */
+    struct pipe_ring *ring= pipe->ring;
+    unsigned *pwant= tag==READER ? &ring->read_want : &ring->write_want;
+    unsigned want= flushed ? need : watermark(pipe, tag, need, count);
+    if (available(pipe, tag)>=want || hungup(pipe, tag) ||
+        need>pipe->capacity)
+      break;
+    unclaim(pipe, turn, tag==READER ? READING : WRITING, TRUE);
+    /* wake revisa waiting y *pwant despues de publicar su indice: con el
+     * smp_mb alguno de los dos ve lo que hizo el otro.  Si ya hay otros
+     * esperando, *pwant es lo que espera el menos exigente. */
+    if (!(ring->waiting & tag) || want<*pwant)
+      WRITE_ONCE(*pwant, want);
+    WRITE_ONCE(ring->waiting, ring->waiting | tag);
+    smp_mb();
+    if (available(pipe, tag)<want && !hungup(pipe, tag)) {
+      if (want==need) {
+        if (c_wait_tag(&pipe->cond, &pipe->mutex, tag)) {
+          rc= -EINTR;
+          break;
+        }
+      }
+      else {
+        int timed= c_timedwait_tag(&pipe->cond, &pipe->mutex, tag, deadline);
+        if (timed==-ETIMEDOUT)
+          flushed= TRUE;
+        else if (timed) {
+          rc= -EINTR;
+          break;
+        }
+      }
+    }
+    if (claim(pipe, turn, tag==READER ? READING : WRITING)) {
+      rc= -EINTR;
+      break;
+    }
+  }
+  if (!locked)
+    m_unlock(&pipe->mutex);
+  return rc;
+}
+
+/* Despierta a los que esperan datos (tag READER) o espacio (WRITER), en
+ * cond o con poll, despues de publicar in o out.  Los que duermen en cond
+ * solo se despiertan si ya hay lo que esperan (ver watermark).  Sin
+ * procesos en espera no pide el mutex ni el spinlock de la cola de
+ * poll. */
+static void wake(Pipe *pipe, unsigned tag, int locked) {
+  wait_queue_head_t *queue= tag==READER ? &pipe->read_queue :
+                                          &pipe->write_queue;
+  struct pipe_ring *ring= pipe->ring;
+  unsigned want;
+  smp_mb();
+  want= tag==READER ? READ_ONCE(ring->read_want) :
+                      READ_ONCE(ring->write_want);
+  if ((READ_ONCE(ring->waiting) & tag) && available(pipe, tag)>=want) {
+    if (!locked)
+      m_lock(&pipe->mutex);
+    WRITE_ONCE(ring->waiting, ring->waiting & ~tag);
+    c_broadcast_tag(&pipe->cond, tag);
+    if (!locked)
+      m_unlock(&pipe->mutex);
+  }
+  if (waitqueue_active(queue))
+    wake_up_interruptible_poll(queue, tag==READER ? EPOLLIN | EPOLLRDNORM :
+                                                    EPOLLOUT | EPOLLWRNORM);
+}
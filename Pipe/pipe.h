@@ -0,0 +1,132 @@
+/* Definiciones que comparten el driver pipe y los programas que lo usan
+ * (ver pipesz.c) */
+
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h> /* __u32, __u64 */
+
+/* Capacidad del buffer del pipe.  Siempre es una potencia de 2 entre
+ * PIPE_MIN_SIZE y PIPE_MAX_SIZE bytes. */
+#define PIPE_MIN_SIZE 4096
+#define PIPE_DEF_SIZE 65536
+#define PIPE_MAX_SIZE (16<<20)
+
+#define PIPE_IOC_MAGIC 'p'
+
+/* ioctl(fd, PIPE_SET_SIZE, bytes) cambia la capacidad del pipe, como
+ * fcntl(fd, F_SETPIPE_SZ, bytes) con un pipe de Linux.  bytes se redondea
+ * hacia arriba a una potencia de 2 y a lo menos PIPE_MIN_SIZE.  Retorna la
+ * nueva capacidad, o -1 con errno EINVAL si bytes excede PIPE_MAX_SIZE, o
+ * EBUSY si el pipe tiene mas datos que los que caben en la nueva capacidad.
+ * ioctl(fd, PIPE_GET_SIZE) retorna la capacidad actual. */
+#define PIPE_SET_SIZE _IO(PIPE_IOC_MAGIC, 0)
+#define PIPE_GET_SIZE _IO(PIPE_IOC_MAGIC, 1)
+
+/* Marcas de agua: un lector que duerme porque el pipe esta vacio solo se
+ * despierta cuando hay a lo menos PIPE_LOWAT bytes (o los que pidio, si
+ * son menos), y un escritor que duerme porque el pipe esta lleno solo se
+ * despierta cuando quedan a lo mas PIPE_HIWAT bytes.  Asi un flujo de
+ * muchos writes pequenos despierta al lector una vez por lote y no una
+ * vez por write.  Los datos que no alcanzan la marca se entregan de todos
+ * modos cuando se cumple el plazo flush_ms (un parametro del modulo).
+ * Por omision la marca baja es 1 y la alta es PIPE_MAX_SIZE, es decir que
+ * se despierta en cuanto hay datos o espacio.
+ * ioctl(fd, PIPE_SET_LOWAT, bytes) y ioctl(fd, PIPE_SET_HIWAT, bytes)
+ * retornan la nueva marca, o -1 con errno EINVAL si bytes excede
+ * PIPE_MAX_SIZE (o es 0 para PIPE_SET_LOWAT).  PIPE_GET_LOWAT y
+ * PIPE_GET_HIWAT retornan la marca actual. */
+#define PIPE_SET_LOWAT _IO(PIPE_IOC_MAGIC, 2)
+#define PIPE_GET_LOWAT _IO(PIPE_IOC_MAGIC, 3)
+#define PIPE_SET_HIWAT _IO(PIPE_IOC_MAGIC, 4)
+#define PIPE_GET_HIWAT _IO(PIPE_IOC_MAGIC, 5)
+
+/* Anillo compartido: mmap(NULL, PIPE_RING_DATA+capacidad,
+ * PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) proyecta el buffer del pipe en
+ * el proceso, de modo que un productor y un consumidor intercambian datos
+ * sin invocar read ni write.  Al comienzo de la proyeccion esta el
+ * encabezado struct pipe_ring y los datos empiezan en PIPE_RING_DATA.
+ * Como ambos lados escriben en el encabezado, el archivo se abre con
+ * O_RDWR.  Mientras el pipe este proyectado PIPE_SET_SIZE falla con
+ * EBUSY.
+ *
+ * in y out cuentan los bytes escritos y leidos sin dar la vuelta: el
+ * pipe tiene in-out bytes y el byte i esta en data[i & (capacity-1)].
+ * El productor copia los datos, publica in con un store-release y lee out
+ * con un load-acquire; el consumidor al reves.  Para dormir y despertar
+ * se usa el driver:
+ *
+ * - ioctl(fd, PIPE_WAIT_READ, bytes) espera que el pipe tenga a lo menos
+ *   bytes, y ioctl(fd, PIPE_WAIT_WRITE, bytes) que tenga espacio para a
+ *   lo menos bytes.  Retornan los bytes disponibles, o -1 con errno EINTR
+ *   si llega una senal, EAGAIN con O_NONBLOCK o EINVAL si bytes es 0 o
+ *   excede la capacidad.  poll tambien sirve para esperar datos o espacio.
+ * - despues de publicar in (o out) y de una barrera completa
+ *   (__atomic_thread_fence(__ATOMIC_SEQ_CST)), si waiting incluye
+ *   PIPE_READER (PIPE_WRITER) y in-out es a lo menos read_want (el
+ *   espacio es a lo menos write_want), el productor (consumidor) invoca
+ *   ioctl(fd, PIPE_WAKE, PIPE_READER) (PIPE_WRITER) para despertar al
+ *   otro lado.
+ *
+ * Asi, mientras nadie duerma, ningun lado hace llamadas al sistema.  Un
+ * lado puede usar el anillo y el otro read o write, pero en un mismo lado
+ * solo puede haber un proceso y no se puede mezclar el anillo con read o
+ * write.  El driver no confia en el encabezado: un proceso que lo altera
+ * solo corrompe los datos de ese pipe.  Como el archivo esta abierto para
+ * leer y escribir, mientras este abierto el driver considera que el pipe
+ * tiene lectores y escritores: quien usa el anillo no recibe el fin de
+ * archivo ni EPIPE, y el otro lado tampoco. */
+#define PIPE_RING_DATA 4096
+
+#define PIPE_READER 1 /* espera datos */
+#define PIPE_WRITER 2 /* espera espacio */
+
+struct pipe_ring {
+  unsigned in, out;
+  unsigned capacity;  /* una copia: el driver usa la suya */
+  unsigned waiting;   /* PIPE_READER y/o PIPE_WRITER duermen en el driver */
+  unsigned read_want; /* bytes que espera el lector dormido */
+  unsigned write_want; /* espacio que espera el escritor dormido */
+};
+
+#define PIPE_WAIT_READ _IO(PIPE_IOC_MAGIC, 6)
+#define PIPE_WAIT_WRITE _IO(PIPE_IOC_MAGIC, 7)
+#define PIPE_WAKE _IO(PIPE_IOC_MAGIC, 8)
+
+/* Modo paquete: ioctl(fd, PIPE_SET_PACKET, 1) hace que cada write se
+ * guarde como un registro, como en un pipe de Linux creado con pipe2 y
+ * O_DIRECT, y PIPE_SET_PACKET con 0 vuelve al flujo de bytes.  Solo se
+ * puede cambiar con el pipe vacio (si no, falla con EBUSY).  En el
+ * buffer cada registro ocupa PIPE_RECORD_HDR bytes con su largo (un
+ * unsigned) seguidos de sus datos; asi lo ve tambien un proceso que
+ * proyecta el anillo.  En modo paquete:
+ * - un write se guarda completo o espera que quepa, y falla con EMSGSIZE
+ *   si su largo mas PIPE_RECORD_HDR excede la capacidad del pipe.  Un
+ *   write de 0 bytes no guarda nada.
+ * - un read entrega un solo registro.  Si el registro no cabe en el
+ *   buffer del read, se entrega el comienzo y el resto se descarta.
+ * - ioctl(fd, PIPE_READ_RECORDS, &recs) entrega en una llamada todos los
+ *   registros completos que quepan en recs.buf, hasta recs.count.
+ *   Espera como read que haya a lo menos uno.  Los deja seguidos en
+ *   recs.buf, deja el largo de cada uno en recs.lengths y en recs.count
+ *   cuantos son, y retorna el total de bytes.  Falla con EMSGSIZE si el
+ *   primer registro no cabe en recs.size bytes, y con EINVAL si el pipe
+ *   no esta en modo paquete.  recs.buf y recs.lengths son direcciones
+ *   (p.ej. (uintptr_t)buf) de 64 bits, para que un proceso de 32 bits
+ *   use el mismo struct con un kernel de 64 bits.
+ * PIPE_GET_PACKET retorna 1 en modo paquete y 0 si no. */
+#define PIPE_RECORD_HDR 4
+
+struct pipe_records {
+  __u64 buf;          /* char * */
+  __u32 size;         /* bytes disponibles en buf */
+  __u32 count;        /* registros que caben en lengths */
+  __u64 lengths;      /* unsigned * */
+};
+
+#define PIPE_SET_PACKET _IO(PIPE_IOC_MAGIC, 9)
+#define PIPE_GET_PACKET _IO(PIPE_IOC_MAGIC, 10)
+#define PIPE_READ_RECORDS _IOWR(PIPE_IOC_MAGIC, 11, struct pipe_records)
+
+#endif
@@ -0,0 +1,51 @@
+/* pipesz: muestra o cambia la capacidad del buffer de /dev/pipe o de
+ * otro pipe del driver (cada minor tiene su propio buffer).
+ *
+ * Uso: ./pipesz [-f device]          (muestra la capacidad actual)
+ *      ./pipesz [-f device] bytes    (la cambia; se redondea a una
+ *                                     potencia de 2)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#include "pipe.h"
+
+#define DEVICE "/dev/pipe"
+
+int main(int argc, char *argv[]) {
+  const char *device= DEVICE;
+  int fd, rc, opt;
+
+  while ((opt= getopt(argc, argv, "f:"))!=-1) {
+    switch (opt) {
+    case 'f': device= optarg; break;
+    default:
+      fprintf(stderr, "usage: %s [-f device] [bytes]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (argc-optind>1) {
+    fprintf(stderr, "usage: %s [-f device] [bytes]\n", argv[0]);
+    return 2;
+  }
+  fd= open(device, O_WRONLY);
+  if (fd<0) {
+    perror(device);
+    return 1;
+  }
+  if (optind<argc)
+    rc= ioctl(fd, PIPE_SET_SIZE, strtoul(argv[optind], NULL, 0));
+  else
+    rc= ioctl(fd, PIPE_GET_SIZE);
+  if (rc<0) {
+    perror(optind<argc ? "PIPE_SET_SIZE" : "PIPE_GET_SIZE");
+    return 1;
+  }
+  printf("%d\n", rc);
+  close(fd);
+  return 0;
+}
@@ -9,7 +9,8 @@
 #include <linux/types.h>  /* size_t */
 #include <linux/proc_fs.h>
 #include <linux/fcntl.h>   /* O_ACCMODE */
-#include <linux/uaccess.h> /* copy_from/to_user */
+#include <linux/uio.h>     /* iov_iter */
+#include <linux/jiffies.h>
 
 #include "kmutex.h"
 
@@ -18,16 +19,17 @@ MODULE_LICENSE("Dual BSD/GPL");
 /* Declaration of syncread.c functions */
 int syncread_open(struct inode *inode, struct file *filp);
 int syncread_release(struct inode *inode, struct file *filp);
-ssize_t syncread_read(struct file *filp, char *buf, size_t count, loff_t *f_pos);
-ssize_t syncread_write(struct file *filp, const char *buf, size_t count, loff_t *f_pos);
+ssize_t syncread_read(struct kiocb *iocb, struct iov_iter *to);
+ssize_t syncread_write(struct kiocb *iocb, struct iov_iter *from);
 void syncread_exit(void);
 int syncread_init(void);
 
 /* Structure that declares the usual file */
-/* access functions */
+/* access functions.  Con read_iter y write_iter un readv o writev de
+ * varios segmentos pide buf_lock una sola vez. */
 struct file_operations syncread_fops = {
-  read : syncread_read,
-  write : syncread_write,
+  read_iter : syncread_read,
+  write_iter : syncread_write,
   open : syncread_open,
   release : syncread_release
 };
@@ -54,10 +56,26 @@ static int readers;
 static int writing;
 static int pend_open_write;
 
-/* El mutex y la condicion para syncread */
+/* Tiempo maximo en milisegundos que un lector espera datos al final del
+ * archivo.  Con 0 espera indefinidamente. */
+static int read_timeout = 0;
+module_param(read_timeout, int, 0644);
+MODULE_PARM_DESC(read_timeout, "max ms a reader waits for more data (0: forever)");
+
+/* El mutex y la condicion para syncread: protegen readers, writing y
+ * pend_open_write */
 static KMutex mutex;
 static KCondition cond;
 
+/* El candado para syncread_buffer y curr_size.  Los lectores lo piden en
+ * modo compartido, de modo que pueden leer en paralelo.  Como los lectores
+ * esperan en data_cond mientras writing sea verdadero, writing solo se
+ * modifica teniendo tambien este candado en modo exclusivo. */
+static KRWLock buf_lock;
+static KCondition data_cond;
+
+static KStatsDir stats_dir;
+
 int syncread_init(void)
 {
   int rc;
@@ -77,6 +95,11 @@ int syncread_init(void)
   curr_size = 0;
   m_init(&mutex);
   c_init(&cond);
+  rw_init(&buf_lock);
+  c_init(&data_cond);
+  m_stats_init(&stats_dir, "syncread");
+  m_stats_register(&stats_dir, "mutex", &mutex);
+  m_stats_register(&stats_dir, "buf_lock", &buf_lock.mutex);
 
   /* Allocating syncread_buffer */
   syncread_buffer = kmalloc(MAX_SIZE, GFP_KERNEL);
@@ -95,6 +118,7 @@ void syncread_exit(void)
 {
   /* Freeing the major number */
   unregister_chrdev(syncread_major, "syncread");
+  m_stats_exit(&stats_dir);
 
   /* Freeing buffer syncread */
   if (syncread_buffer)
@@ -126,9 +150,11 @@ int syncread_open(struct inode *inode, struct file *filp)
         goto epilog;
       }
     }
+    rw_wlock(&buf_lock);
     writing = TRUE;
-    pend_open_write--;
     curr_size = 0;
+    rw_wunlock(&buf_lock);
+    pend_open_write--;
     c_broadcast(&cond);
     printk("<1>open for write successful\n");
   }
@@ -162,7 +188,11 @@ int syncread_release(struct inode *inode, struct file *filp)
 
   if (filp->f_mode & FMODE_WRITE)
   {
+    rw_wlock(&buf_lock);
     writing = FALSE;
+    rw_wunlock(&buf_lock);
+    /* los lectores que esperaban datos al final del archivo ven EOF */
+    rw_broadcast(&data_cond, &buf_lock);
     c_broadcast(&cond);
     printk("<1>close for write successful\n");
   }
@@ -178,21 +208,27 @@ int syncread_release(struct inode *inode, struct file *filp)
   return 0;
 }
 
-ssize_t syncread_read(struct file *filp, char *buf,
-                      size_t count, loff_t *f_pos)
+ssize_t syncread_read(struct kiocb *iocb, struct iov_iter *to)
 {
+  loff_t *f_pos = &iocb->ki_pos;
+  size_t count = iov_iter_count(to), copied;
   ssize_t rc;
-  m_lock(&mutex);
+  int timeout = read_timeout;
+  unsigned long deadline = jiffies + msecs_to_jiffies(timeout);
+  rw_rlock(&buf_lock);
 
   while (curr_size <= *f_pos && writing)
   {
     /* si el lector esta en el final del archivo pero hay un proceso
      * escribiendo todavia en el archivo, el lector espera.
      */
-    if (c_wait(&cond, &mutex))
+    if (timeout > 0)
+      rc = rw_rtimedwait(&data_cond, &buf_lock, deadline);
+    else
+      rc = rw_rwait(&data_cond, &buf_lock);
+    if (rc)
     {
-      printk("<1>read interrupted\n");
-      rc = -EINTR;
+      printk(rc == -ETIMEDOUT ? "<1>read timed out\n" : "<1>read interrupted\n");
       goto epilog;
     }
   }
@@ -205,28 +241,30 @@ ssize_t syncread_read(struct file *filp, char *buf,
   printk("<1>read %d bytes at %d\n", (int)count, (int)*f_pos);
 
   /* Transfiriendo datos hacia el espacio del usuario */
-  if (copy_to_user(buf, syncread_buffer + *f_pos, count) != 0)
+  copied = copy_to_iter(syncread_buffer + *f_pos, count, to);
+  if (copied == 0 && count > 0)
   {
-    /* el valor de buf es una direccion invalida */
+    /* la direccion de destino es invalida */
     rc = -EFAULT;
     goto epilog;
   }
 
-  *f_pos += count;
-  rc = count;
+  *f_pos += copied;
+  rc = copied;
 
 epilog:
-  m_unlock(&mutex);
+  rw_runlock(&buf_lock);
   return rc;
 }
 
-ssize_t syncread_write(struct file *filp, const char *buf,
-                       size_t count, loff_t *f_pos)
+ssize_t syncread_write(struct kiocb *iocb, struct iov_iter *from)
 {
+  loff_t *f_pos = &iocb->ki_pos;
+  size_t count = iov_iter_count(from), copied;
   ssize_t rc;
   loff_t last;
 
-  m_lock(&mutex);
+  rw_wlock(&buf_lock);
 
   last = *f_pos + count;
   if (last > MAX_SIZE)
@@ -235,20 +273,23 @@ ssize_t syncread_write(struct file *filp, const char *buf,
   }
   printk("<1>write %d bytes at %d\n", (int)count, (int)*f_pos);
 
-  /* Transfiriendo datos desde el espacio del usuario */
-  if (copy_from_user(syncread_buffer + *f_pos, buf, count) != 0)
+  /* Transfiriendo datos desde el espacio del usuario, con todos los
+   * segmentos de un writev seguidos */
+  copied = copy_from_iter(syncread_buffer + *f_pos, count, from);
+  if (copied == 0 && count > 0)
   {
-    /* el valor de buf es una direccion invalida */
+    /* la direccion de origen es invalida */
     rc = -EFAULT;
     goto epilog;
   }
 
-  *f_pos += count;
+  *f_pos += copied;
   curr_size = *f_pos;
-  rc = count;
-  c_broadcast(&cond);
+  rc = copied;
 
 epilog:
-  m_unlock(&mutex);
+  rw_wunlock(&buf_lock);
+  if (rc > 0)
+    rw_broadcast(&data_cond, &buf_lock);
   return rc;
 }